@@ -0,0 +1,225 @@
+/*
+ * File: alog.c
+ * Purpose: This file contains the access log module, which formats and
+ *          writes log records in a background thread.  Please see alog.h
+ *          for documentation on how to use this module.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "alog.h"
+
+#define BATCH 65536                        /* bytes formatted per write */
+
+struct record {
+  long long time;                          /* ns since the epoch */
+  long long bytes;
+  long long usec;
+  int kind;
+  int level;
+  char path[ALOG_PATH];
+};
+
+/* one thread's records: the thread moves head, the flusher tail */
+struct ring {
+  _Alignas( 64 ) atomic_ulong head;
+  _Alignas( 64 ) atomic_ulong tail;
+  _Atomic unsigned long dropped;           /* written by the thread only */
+  struct ring *next;                       /* all rings */
+  struct record records[ALOG_RING];
+};
+
+static const int verbosities[] = { 1, 1, 2, 3, 1 };   /* by kind */
+
+static int verbosity;
+static __thread struct ring *mine;
+static _Atomic( struct ring * ) rings;
+static unsigned long reported;             /* drops already logged */
+static atomic_ulong passes;                /* flushes finished */
+
+
+/* give the calling thread a ring and make it visible to the flusher */
+static struct ring *new_ring() {
+  struct ring *r = calloc( 1, sizeof( struct ring ) );
+
+  if( !r ) {                                            /* error check */
+    perror( "Error while allocating memory" );
+    abort();
+  }
+  r->next = atomic_load( &rings );
+  while( !atomic_compare_exchange_weak( &rings, &r->next, r ) );
+  return r;
+}
+
+
+extern void alog_write( int kind, const char *path, long long bytes,
+                        long long usec, int level ) {
+  struct timespec ts;
+  struct record *rec;
+  unsigned long head;
+
+  if( verbosity < verbosities[kind] ) {
+    return;
+  }
+  if( !mine ) {                                         /* 1st use by thread */
+    mine = new_ring();
+  }
+
+  head = atomic_load_explicit( &mine->head, memory_order_relaxed );
+  if( head - atomic_load_explicit( &mine->tail, memory_order_acquire ) == ALOG_RING ) {
+    atomic_store_explicit( &mine->dropped,              /* full, do not wait */
+      atomic_load_explicit( &mine->dropped, memory_order_relaxed ) + 1,
+      memory_order_relaxed );
+    return;
+  }
+
+  rec = &mine->records[head & ( ALOG_RING - 1 )];
+  clock_gettime( CLOCK_REALTIME, &ts );
+  rec->time = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+  rec->kind = kind;
+  rec->bytes = bytes;
+  rec->usec = usec;
+  rec->level = level;
+  strncpy( rec->path, path, ALOG_PATH - 1 );
+  rec->path[ALOG_PATH - 1] = '\0';
+  atomic_store_explicit( &mine->head, head + 1, memory_order_release );
+}
+
+
+/* print a record into out; returns its length */
+static int format( const struct record *rec, char *out ) {
+  time_t sec = rec->time / 1000000000LL;
+  struct tm tm;
+  int len;
+
+  localtime_r( &sec, &tm );
+  len = strftime( out, 32, "%H:%M:%S", &tm );
+  len += sprintf( out + len, ".%06lld ", rec->time % 1000000000LL / 1000 );
+
+  switch( rec->kind ) {
+  case ALOG_DONE:
+    return len + sprintf( out + len, "Request for file %s completed, %lld bytes in %lld us (level %d)\n",
+                          rec->path, rec->bytes, rec->usec, rec->level );
+  case ALOG_NOTFOUND:
+    return len + sprintf( out + len, "Request for file %s not found\n", rec->path );
+  case ALOG_ADMIT:
+    return len + sprintf( out + len, "Request for file %s admitted\n", rec->path );
+  case ALOG_FAILED:
+    return len + sprintf( out + len, "Request for file %s failed, %lld bytes (level %d)\n",
+                          rec->path, rec->bytes, rec->level );
+  default:
+    return len + sprintf( out + len, "Sent %lld bytes of file %s (level %d)\n",
+                          rec->bytes, rec->path, rec->level );
+  }
+}
+
+
+/* format what every ring holds and write it out; returns the number of
+ * records written */
+static long flush( char *buf ) {
+  struct ring *r;
+  unsigned long head;
+  unsigned long tail;
+  unsigned long dropped = 0;
+  long n = 0;
+  int len = 0;
+
+  for( r = atomic_load( &rings ); r; r = r->next ) {
+    head = atomic_load_explicit( &r->head, memory_order_acquire );
+    tail = atomic_load_explicit( &r->tail, memory_order_relaxed );
+    for( ; tail != head; tail++, n++ ) {
+      if( len > BATCH - 256 ) {                         /* batch is full */
+        fwrite( buf, 1, len, stdout );
+        len = 0;
+      }
+      len += format( &r->records[tail & ( ALOG_RING - 1 )], buf + len );
+      atomic_store_explicit( &r->tail, tail + 1, memory_order_release );
+    }
+    dropped += atomic_load_explicit( &r->dropped, memory_order_relaxed );
+  }
+
+  if( dropped != reported ) {
+    if( len > BATCH - 256 ) {
+      fwrite( buf, 1, len, stdout );
+      len = 0;
+    }
+    len += sprintf( buf + len, "access log: %lu records dropped\n", dropped - reported );
+    reported = dropped;
+  }
+  if( len ) {
+    fwrite( buf, 1, len, stdout );
+    fflush( stdout );
+  }
+  atomic_fetch_add( &passes, 1 );
+  return n;
+}
+
+
+/* loop function of the flusher thread */
+static void *flusher( void *arg ) {
+  const struct timespec interval = { 0, ALOG_INTERVAL * 1000000L };
+  char *buf = malloc( BATCH );
+
+  (void) arg;                                           /* nothing to pass */
+  if( !buf ) {                                          /* error check */
+    perror( "Error while allocating memory" );
+    abort();
+  }
+  for( ;; ) {
+    if( flush( buf ) < ALOG_RING / 2 ) {                /* keeping up, sleep */
+      nanosleep( &interval, NULL );
+    }
+  }
+  return NULL;
+}
+
+
+extern void alog_init( int level ) {
+  pthread_t thread;
+
+  verbosity = level;
+  if( verbosity > 0 ) {
+    if( pthread_create( &thread, NULL, flusher, NULL ) ) {
+      perror( "Error starting access log" );
+      abort();
+    }
+    pthread_detach( thread );
+  }
+}
+
+
+extern unsigned long alog_dropped() {
+  struct ring *r;
+  unsigned long dropped = 0;
+
+  for( r = atomic_load( &rings ); r; r = r->next ) {
+    dropped += atomic_load_explicit( &r->dropped, memory_order_relaxed );
+  }
+  return dropped;
+}
+
+
+extern void alog_sync() {
+  const struct timespec interval = { 0, ALOG_INTERVAL * 1000000L };
+  struct ring *r;
+  unsigned long pass;
+
+  if( verbosity == 0 ) {
+    return;
+  }
+  for( r = atomic_load( &rings ); r; r = r->next ) {
+    while( atomic_load_explicit( &r->tail, memory_order_acquire ) !=
+           atomic_load_explicit( &r->head, memory_order_acquire ) ) {
+      nanosleep( &interval, NULL );                     /* flusher is on it */
+    }
+  }
+  pass = atomic_load( &passes );             /* the last records' batch is */
+  while( atomic_load( &passes ) < pass + 2 ) {         /* written by then */
+    nanosleep( &interval, NULL );
+  }
+}
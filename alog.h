@@ -0,0 +1,81 @@
+/*
+ * File: alog.h
+ * Purpose: This file contains the prototypes and describes how to use the
+ *          access log module, which logs requests without making the
+ *          threads serving them wait for stdout.
+ */
+
+#ifndef ALOG_H
+#define ALOG_H
+
+#define ALOG_RING 4096                     /* records per thread, power of 2 */
+#define ALOG_PATH 96                       /* path bytes kept in a record */
+#define ALOG_INTERVAL 10                   /* ms between flushes when idle */
+#define ALOG_VERBOSITY 1                   /* default: one line per request */
+
+#define ALOG_DONE 0                        /* response completed */
+#define ALOG_NOTFOUND 1                    /* 404 sent */
+#define ALOG_ADMIT 2                       /* request admitted */
+#define ALOG_SLICE 3                       /* scheduler slice sent */
+#define ALOG_FAILED 4                      /* response cut short by an error */
+
+/*
+ * This module keeps an access log:
+ *   alog_init()    : set the verbosity and start the flusher thread
+ *   alog_write()   : log an event of the calling thread
+ *   alog_dropped() : the number of records dropped so far
+ *   alog_sync()    : wait until every record logged so far is written
+ *
+ * Each kind of event is logged from a verbosity up: completed and failed
+ * requests and 404s from 1, admitted requests from 2 and every scheduler slice
+ * from 3.  At verbosity 0 nothing is logged and alog_write() returns at
+ * once.
+ *
+ * alog_write() copies a fixed size binary record into a ring owned by the
+ * calling thread; only that thread writes the ring and only the flusher
+ * reads it, so no lock is taken.  The flusher thread formats the records
+ * of every ring and writes them to stdout in batches.  A thread whose ring
+ * is full drops the record and counts it rather than wait.
+ */
+
+
+/* This function sets the verbosity and, unless it is 0, starts the
+ *    flusher thread.  This function will abort the program if an error
+ *    occurs.
+ * Parameters:
+ *             verbosity : the highest verbosity of events to log
+ * Returns: None
+ */
+extern void alog_init( int verbosity );
+
+
+/* This function logs an event, if the verbosity is high enough.
+ * Parameters:
+ *             kind  : ALOG_DONE, ALOG_NOTFOUND, ALOG_ADMIT, ALOG_SLICE or
+ *                     ALOG_FAILED
+ *             path  : the requested path
+ *             bytes : the bytes of the response (ALOG_DONE, ALOG_FAILED) or
+ *                     slice
+ *             usec  : the microseconds the request took (ALOG_DONE)
+ *             level : the scheduler level of the client
+ * Returns: None
+ */
+extern void alog_write( int kind, const char *path, long long bytes,
+                        long long usec, int level );
+
+
+/* This function counts the records dropped because a ring was full.
+ * Parameters: None
+ * Returns: The number of records dropped since alog_init()
+ */
+extern unsigned long alog_dropped();
+
+
+/* This function waits until the flusher has written every record logged
+ *    before the call, e.g. before the program exits.
+ * Parameters: None
+ * Returns: None
+ */
+extern void alog_sync();
+
+#endif
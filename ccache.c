@@ -0,0 +1,318 @@
+/*
+ * File: ccache.c
+ * Purpose: This file contains the content cache module, which keeps the
+ *          bodies of frequently requested small files in memory.  Please
+ *          see ccache.h for documentation on how to use this module.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "ccache.h"
+
+#define CCACHE_SHARDS 16                   /* independently locked tables */
+#define CCACHE_BUCKETS 1024                /* hash chains per shard */
+#define SKETCH_ROWS 4
+#define SKETCH_WIDTH 4096                  /* counters per row, power of 2 */
+#define SKETCH_MAX 15                      /* counters saturate here */
+#define SKETCH_SAMPLE ( SKETCH_WIDTH * 8 ) /* increments between halvings */
+
+struct shard {
+  pthread_mutex_t lock;
+  struct ccache_obj *buckets[CCACHE_BUCKETS];
+  struct ccache_obj *hand;               /* CLOCK hand, NULL if empty */
+  size_t used;                           /* bytes of cached bodies */
+  size_t budget;
+  unsigned int additions;                /* sketch increments since halving */
+  uint8_t sketch[SKETCH_ROWS][SKETCH_WIDTH];
+  unsigned long objects;
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;
+  unsigned long rejections;
+};
+
+static struct shard *shards;
+static size_t max_object;
+
+static const uint32_t seeds[SKETCH_ROWS] = {
+  0x9e3779b1u, 0x85ebca77u, 0xc2b2ae3du, 0x27d4eb2fu
+};
+
+
+/* slot of a key in one row of the sketch */
+static unsigned int sketch_slot( unsigned int hash, int row ) {
+  return ( ( hash * seeds[row] ) >> 16 ) & ( SKETCH_WIDTH - 1 );
+}
+
+
+/* estimated request frequency of a key: the smallest of its counters */
+static int sketch_estimate( struct shard *sh, unsigned int hash ) {
+  int min = SKETCH_MAX;
+  int row;
+
+  for( row = 0; row < SKETCH_ROWS; row++ ) {
+    int c = sh->sketch[row][sketch_slot( hash, row )];
+    if( c < min ) {
+      min = c;
+    }
+  }
+  return min;
+}
+
+
+/* count one request for a key, ageing the whole sketch now and then so
+ * that files which used to be popular fade out */
+static void sketch_increment( struct shard *sh, unsigned int hash ) {
+  int row;
+  int col;
+
+  for( row = 0; row < SKETCH_ROWS; row++ ) {
+    uint8_t *c = &sh->sketch[row][sketch_slot( hash, row )];
+    if( *c < SKETCH_MAX ) {
+      ( *c )++;
+    }
+  }
+
+  if( ++sh->additions >= SKETCH_SAMPLE ) {
+    for( row = 0; row < SKETCH_ROWS; row++ ) {
+      for( col = 0; col < SKETCH_WIDTH; col++ ) {
+        sh->sketch[row][col] >>= 1;
+      }
+    }
+    sh->additions = 0;
+  }
+}
+
+
+/* find the body for path in a locked shard */
+static struct ccache_obj *lookup( struct shard *sh, const char *path,
+                                  unsigned int hash ) {
+  struct ccache_obj *o;
+
+  for( o = sh->buckets[( hash / CCACHE_SHARDS ) % CCACHE_BUCKETS]; o;
+       o = o->next ) {
+    if( ( o->hash == hash ) && !strcmp( o->path, path ) ) {
+      return o;
+    }
+  }
+  return NULL;
+}
+
+
+/* add a body to a locked shard, just behind the CLOCK hand */
+static void insert( struct shard *sh, struct ccache_obj *o ) {
+  struct ccache_obj **bucket;
+
+  bucket = &sh->buckets[( o->hash / CCACHE_SHARDS ) % CCACHE_BUCKETS];
+  o->next = *bucket;
+  *bucket = o;
+
+  if( !sh->hand ) {
+    o->prev_clock = o->next_clock = o;
+    sh->hand = o;
+  } else {
+    o->next_clock = sh->hand;
+    o->prev_clock = sh->hand->prev_clock;
+    o->prev_clock->next_clock = o;
+    sh->hand->prev_clock = o;
+  }
+  o->cached = 1;
+  o->referenced = 0;
+  sh->used += o->size;
+  sh->objects++;
+}
+
+
+/* remove a body from a locked shard; the caller releases the cache's
+ * reference once the lock is dropped */
+static void unlink_obj( struct shard *sh, struct ccache_obj *o ) {
+  struct ccache_obj **p;
+
+  for( p = &sh->buckets[( o->hash / CCACHE_SHARDS ) % CCACHE_BUCKETS];
+       *p != o; p = &( *p )->next );
+  *p = o->next;
+
+  if( o->next_clock == o ) {
+    sh->hand = NULL;
+  } else {
+    o->prev_clock->next_clock = o->next_clock;
+    o->next_clock->prev_clock = o->prev_clock;
+    if( sh->hand == o ) {
+      sh->hand = o->next_clock;
+    }
+  }
+  o->cached = 0;
+  sh->used -= o->size;
+  sh->objects--;
+}
+
+
+/* advance the CLOCK hand past recently used bodies to the next victim */
+static struct ccache_obj *clock_victim( struct shard *sh ) {
+  while( sh->hand && sh->hand->referenced ) {
+    sh->hand->referenced = 0;                           /* second chance */
+    sh->hand = sh->hand->next_clock;
+  }
+  return sh->hand;
+}
+
+
+extern void ccache_init( size_t budget ) {
+  int i;
+
+  if( !budget ) {                                       /* disabled */
+    return;
+  }
+
+  shards = calloc( CCACHE_SHARDS, sizeof( struct shard ) );
+  if( !shards ) {                                       /* error check */
+    perror( "Error while allocating memory" );
+    abort();
+  }
+  for( i = 0; i < CCACHE_SHARDS; i++ ) {
+    pthread_mutex_init( &shards[i].lock, NULL );
+    shards[i].budget = budget / CCACHE_SHARDS;
+  }
+
+  max_object = budget / CCACHE_SHARDS;                  /* must fit a shard */
+  if( max_object > CCACHE_MAX_OBJECT ) {
+    max_object = CCACHE_MAX_OBJECT;
+  }
+}
+
+
+extern struct ccache_obj *ccache_get( struct fcache_entry *file ) {
+  struct shard *sh;
+  struct ccache_obj *dropped = NULL;
+  struct ccache_obj *o;
+  struct ccache_obj *victim;
+  size_t done;
+  ssize_t len;
+  int freq;
+
+  if( !shards || ( file->size <= 0 ) || ( (size_t)file->size > max_object ) ) {
+    return NULL;                                        /* not cacheable */
+  }
+  sh = &shards[file->hash % CCACHE_SHARDS];
+
+  pthread_mutex_lock( &sh->lock );
+  sketch_increment( sh, file->hash );
+  o = lookup( sh, file->path, file->hash );
+  if( o && ( o->id == file->id ) ) {                    /* hit */
+    o->referenced = 1;
+    atomic_fetch_add( &o->refs, 1 );
+    sh->hits++;
+    pthread_mutex_unlock( &sh->lock );
+    return o;
+  }
+  if( o ) {                                             /* file changed */
+    unlink_obj( sh, o );
+    dropped = o;
+  }
+  sh->misses++;
+
+  /* only read the body if it could be admitted: either it fits, or it is
+   * requested more often than the body CLOCK would evict first */
+  freq = sketch_estimate( sh, file->hash );
+  victim = clock_victim( sh );
+  if( ( sh->used + file->size > sh->budget ) && victim &&
+      ( sketch_estimate( sh, victim->hash ) >= freq ) ) {
+    sh->rejections++;
+    pthread_mutex_unlock( &sh->lock );
+    if( dropped ) {
+      ccache_release( dropped );
+    }
+    return NULL;
+  }
+  pthread_mutex_unlock( &sh->lock );
+  if( dropped ) {
+    ccache_release( dropped );
+    dropped = NULL;
+  }
+
+  o = malloc( sizeof( struct ccache_obj ) + file->size );  /* read it in */
+  if( !o ) {
+    return NULL;
+  }
+  for( done = 0; done < (size_t)file->size; done += len ) {
+    len = pread( file->fd, o->data + done, file->size - done, done );
+    if( len <= 0 ) {                                    /* file shrank */
+      free( o );
+      return NULL;
+    }
+  }
+  strncpy( o->path, file->path, FCACHE_PATH );
+  o->id = file->id;
+  o->hash = file->hash;
+  o->size = file->size;
+  o->cached = 0;
+  atomic_init( &o->refs, 1 );                           /* caller's reference */
+
+  pthread_mutex_lock( &sh->lock );
+  victim = lookup( sh, o->path, o->hash );
+  if( victim && ( victim->id == o->id ) ) {             /* lost a race */
+    victim->referenced = 1;
+    atomic_fetch_add( &victim->refs, 1 );
+    pthread_mutex_unlock( &sh->lock );
+    free( o );
+    return victim;
+  }
+  if( victim ) {
+    unlink_obj( sh, victim );
+    victim->next = dropped;
+    dropped = victim;
+  }
+  while( sh->used + o->size > sh->budget ) {            /* make room */
+    victim = clock_victim( sh );
+    if( !victim || ( sketch_estimate( sh, victim->hash ) >= freq ) ) {
+      break;
+    }
+    unlink_obj( sh, victim );
+    sh->evictions++;
+    victim->next = dropped;
+    dropped = victim;
+  }
+  if( sh->used + o->size <= sh->budget ) {
+    atomic_fetch_add( &o->refs, 1 );                    /* cache's reference */
+    insert( sh, o );
+  } else {
+    sh->rejections++;                                   /* serve it once */
+  }
+  pthread_mutex_unlock( &sh->lock );
+
+  while( dropped ) {
+    victim = dropped->next;
+    ccache_release( dropped );
+    dropped = victim;
+  }
+  return o;
+}
+
+
+extern void ccache_release( struct ccache_obj *obj ) {
+  if( atomic_fetch_sub( &obj->refs, 1 ) == 1 ) {        /* last reference */
+    free( obj );
+  }
+}
+
+
+extern void ccache_stats( struct ccache_stats *stats ) {
+  int i;
+
+  memset( stats, 0, sizeof( struct ccache_stats ) );
+  for( i = 0; shards && ( i < CCACHE_SHARDS ); i++ ) {
+    pthread_mutex_lock( &shards[i].lock );
+    stats->hits += shards[i].hits;
+    stats->misses += shards[i].misses;
+    stats->evictions += shards[i].evictions;
+    stats->rejections += shards[i].rejections;
+    stats->bytes += shards[i].used;
+    stats->objects += shards[i].objects;
+    pthread_mutex_unlock( &shards[i].lock );
+  }
+}
@@ -0,0 +1,96 @@
+/*
+ * File: ccache.h
+ * Purpose: This file contains the prototypes and describes how to use the
+ *          content cache module, which keeps the bodies of frequently
+ *          requested small files in memory.
+ */
+
+#ifndef CCACHE_H
+#define CCACHE_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+#include "fcache.h"
+
+#define CCACHE_BUDGET ( 32 << 20 )         /* default bytes of file bodies */
+#define CCACHE_MAX_OBJECT ( 1 << 20 )      /* larger files are never cached */
+
+/*
+ * This module keeps file bodies in memory, up to a byte budget:
+ *   ccache_init()    : initializes the module
+ *   ccache_get()     : return the body of an open file, from memory
+ *   ccache_release() : drop a reference returned by ccache_get()
+ *   ccache_stats()   : read the hit, miss and eviction counters
+ *
+ * The cache is split into independently locked shards.  Each shard
+ * estimates how often every path is requested with a small count-min
+ * sketch whose counters are halved periodically (TinyLFU).  A new body is
+ * only admitted when it is requested more often than the body CLOCK would
+ * evict for it, so a scan over many files that are each fetched once
+ * cannot flush the popular ones.
+ *
+ * Bodies are keyed by the file cache entry they were read from, so a body
+ * is never served after its file changed (see fcache.h).
+ */
+
+struct ccache_obj {
+  char path[FCACHE_PATH];                /* request path, the key */
+  unsigned long id;                      /* fcache entry it was read from */
+  unsigned int hash;
+  size_t size;                           /* bytes in data */
+  atomic_int refs;                       /* cache's reference + clients' */
+  int referenced;                        /* CLOCK bit */
+  int cached;                            /* still in the table */
+  struct ccache_obj *next;               /* hash chain */
+  struct ccache_obj *prev_clock;         /* CLOCK ring of the shard */
+  struct ccache_obj *next_clock;
+  char data[];                           /* the file body */
+};
+
+struct ccache_stats {
+  unsigned long hits;                    /* requests served from memory */
+  unsigned long misses;                  /* cacheable requests read from disk */
+  unsigned long evictions;               /* bodies dropped to make room */
+  unsigned long rejections;              /* bodies not admitted (TinyLFU) */
+  unsigned long bytes;                   /* bytes of bodies cached */
+  unsigned long objects;                 /* bodies cached */
+};
+
+
+/* This function initializes the content cache.  This function will abort
+ *   the program if an error occurs.
+ * Parameters:
+ *             budget : the most bytes of file bodies to keep, 0 to disable
+ * Returns: None
+ */
+extern void ccache_init( size_t budget );
+
+
+/* This function returns the body of an open file from memory, reading it
+ *    in if it is worth caching.
+ * Parameters:
+ *             file : the file cache entry of the requested file
+ * Returns: A referenced body, which must be passed to ccache_release()
+ *          when the caller is done with it, or NULL if the file should be
+ *          sent from disk
+ */
+extern struct ccache_obj *ccache_get( struct fcache_entry *file );
+
+
+/* This function drops a reference returned by ccache_get().
+ * Parameters:
+ *             obj : the body
+ * Returns: None
+ */
+extern void ccache_release( struct ccache_obj *obj );
+
+
+/* This function reads the cache's counters.
+ * Parameters:
+ *             stats : filled in with the current counters
+ * Returns: None
+ */
+extern void ccache_stats( struct ccache_stats *stats );
+
+#endif
@@ -2,18 +2,69 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <limits.h>
+#include <pthread.h>
 
 #include "datastruct.h"
+#include "pool.h"
+
+static struct pool client_pool;
+static struct pool node_pool;
+static pthread_once_t pools_once = PTHREAD_ONCE_INIT;
+
+static void initPools() {
+	pool_init(&client_pool, sizeof(struct client), POOL_SLAB);
+	pool_init(&node_pool, sizeof(struct node), POOL_SLAB * 4);
+}
 
 void initClient(struct client* client) {
-	client->filename = (char*)malloc(sizeof(char)*128);
+	client->filename[0] = '\0';
 	client->fd = 0;
-	client->fin = NULL;
+	client->file = NULL;
+	client->body = NULL;
+	client->page = NULL;
+	client->hdr = NULL;
+	client->hdrlen = 0;
 	client->rem = 0;
 	client->pos = 0;
+	client->xfer = XFER_SENDFILE;
+	client->level = 0;
+	client->deficit = 0;
+	client->weight = 1;
+	client->qnext = NULL;
+	client->queued = 0;
+	client->inoff = 0;
+	client->inlen = 0;
+	client->inscan = 0;
+	client->keepalive = 0;
+	client->idle = 0;
+	client->parked = 0;
+	client->wnext = NULL;
+	client->wprev = NULL;
+	client->nranges = 0;
+	client->range = 0;
+	client->partrem = 0;
+	client->size = 0;
+	client->arrived = 0;
+	client->admitted = 0;
+	client->started = 0;
+}
+
+struct client* newClient() {
+	struct client *client;
+
+	pthread_once(&pools_once, initPools);
+	client = (struct client*) pool_alloc(&client_pool);
+	initClient(client);
+	return client;
+}
+
+void freeClient(struct client* client) {
+	pool_free(client);
 }
 
 void initList(struct linkedlist* list) {
+	pthread_once(&pools_once, initPools);
 	list->head = NULL;
 	list->tail = NULL;
 	list->size = 0; 
@@ -21,7 +72,8 @@ void initList(struct linkedlist* list) {
 
 //display client
 void printClient(struct client* client) {
-	printf("[%s, %d, %p, %d, %d]",client->filename, client->fd, client->fin, client->rem, client-> pos);
+	printf("[%s, %d, %p, %lld, %lld]",client->filename, client->fd, client->file,
+			(long long) client->rem, (long long) client->pos);
 }
 
 //display the list
@@ -53,7 +105,7 @@ void rotate(struct linkedlist* list) {
 //insert link at the first location
 void insertFirst(struct linkedlist* list, struct client* client) {
 	//create a link
-	struct node *link = (struct node*) malloc(sizeof(struct node));
+	struct node *link = (struct node*) pool_alloc(&node_pool);
 
 	link->client = client;
 
@@ -85,7 +137,7 @@ void insertFirst(struct linkedlist* list, struct client* client) {
 //insert link at the first location
 void insertLast(struct linkedlist* list, struct client* client) {
 	//create a link
-	struct node *link = (struct node*) malloc(sizeof(struct node));
+	struct node *link = (struct node*) pool_alloc(&node_pool);
 
 	link->client = client;
 
@@ -123,6 +175,7 @@ struct client* deleteFirst(struct linkedlist* list) {
 
 	//save reference to first link
 	struct node *tempLink = list->head;
+	struct client *client;
 
 	//update head and tail and next/prev
 	list->head = list->head->next;
@@ -133,7 +186,9 @@ struct client* deleteFirst(struct linkedlist* list) {
 	list->size--;
 
 	//return the deleted link
-	return tempLink->client;
+	client = tempLink->client;
+	pool_free(tempLink);
+	return client;
 }
 
 //is list empty
@@ -219,7 +274,9 @@ struct client* delete(struct linkedlist* list, struct client* client) {
 
 	//update size
 	list->size--;
-	return current->client;
+	client = current->client;
+	pool_free(current);
+	return client;
 }
 
 //sort by size of file to download
@@ -250,6 +307,321 @@ void sort(struct linkedlist* list) {
 	}   
 }
 
+//initialize heap
+void initHeap(struct heap* heap) {
+	heap->entries = NULL;
+	atomic_init(&heap->size, 0);
+	heap->capacity = 0;
+	heap->seq = 0;
+}
+
+//is entry a ahead of entry b (smaller key, or same key and inserted first)
+static int heapBefore(struct heapentry* a, struct heapentry* b) {
+	return a->key < b->key || (a->key == b->key && a->seq < b->seq);
+}
+
+//insert client keyed on its remaining bytes
+void heapInsert(struct heap* heap, struct client* client) {
+	struct heapentry entry;
+	int n = atomic_load_explicit(&heap->size, memory_order_relaxed);
+	int i;
+
+	//grow array when full
+	if (n == heap->capacity) {
+		heap->capacity = heap->capacity ? heap->capacity * 2 : 64;
+		heap->entries = (struct heapentry*) realloc(heap->entries,
+				sizeof(struct heapentry) * heap->capacity);
+		if (!heap->entries) {
+			perror("Error while allocating memory");
+			abort();
+		}
+	}
+
+	entry.key = client->rem;
+	entry.seq = heap->seq++;
+	entry.client = client;
+
+	//sift up: move parents down until entry's slot is found
+	for (i = n; i > 0; i = (i - 1) / 2) {
+		if (!heapBefore(&entry, &heap->entries[(i - 1) / 2])) {
+			break;
+		}
+		heap->entries[i] = heap->entries[(i - 1) / 2];
+	}
+	heap->entries[i] = entry;
+	atomic_store(&heap->size, n + 1);
+}
+
+//return client with fewest remaining bytes
+struct client* heapPeek(struct heap* heap) {
+	return heapSize(heap) ? heap->entries[0].client : NULL;
+}
+
+//remove and return client with fewest remaining bytes
+struct client* heapPop(struct heap* heap) {
+	struct heapentry last;
+	struct client *client;
+	int n = atomic_load_explicit(&heap->size, memory_order_relaxed);
+	int child;
+	int i;
+
+	if (n == 0) {
+		return NULL;
+	}
+	client = heap->entries[0].client;
+	last = heap->entries[--n];
+	atomic_store(&heap->size, n);
+
+	//sift down: move smaller children up until last's slot is found
+	for (i = 0; (child = 2 * i + 1) < n; i = child) {
+		if (child + 1 < n &&
+				heapBefore(&heap->entries[child + 1], &heap->entries[child])) {
+			child++;
+		}
+		if (!heapBefore(&heap->entries[child], &last)) {
+			break;
+		}
+		heap->entries[i] = heap->entries[child];
+	}
+	heap->entries[i] = last;
+	return client;
+}
+
+//size of heap, read without the lock
+int heapSize(struct heap* heap) {
+	return atomic_load(&heap->size);
+}
+
+//allocate a deque array of size slots
+static struct dequearray* newDequeArray(long size) {
+	struct dequearray *a = (struct dequearray*) malloc(sizeof(struct dequearray));
+	if (a) {
+		a->buf = malloc(sizeof(*a->buf) * size);
+	}
+	if (!a || !a->buf) {
+		perror("Error while allocating memory");
+		abort();
+	}
+	a->size = size;
+	a->prev = NULL;
+	return a;
+}
+
+//initialize deque
+void initDeque(struct deque* dq) {
+	atomic_init(&dq->top, 0);
+	atomic_init(&dq->bottom, 0);
+	atomic_init(&dq->array, newDequeArray(64));
+}
+
+//double the array, copying the live slots t..b-1
+static struct dequearray* growDeque(struct deque* dq, struct dequearray* a, long t, long b) {
+	struct dequearray *bigger = newDequeArray(a->size * 2);
+
+	for (long i = t; i < b; i++) {
+		atomic_store_explicit(&bigger->buf[i & (bigger->size - 1)],
+				atomic_load_explicit(&a->buf[i & (a->size - 1)], memory_order_relaxed),
+				memory_order_relaxed);
+	}
+	bigger->prev = a;
+	atomic_store_explicit(&dq->array, bigger, memory_order_release);
+	return bigger;
+}
+
+//push client on the bottom of the deque
+void dequePush(struct deque* dq, struct client* client) {
+	long b = atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+	long t = atomic_load_explicit(&dq->top, memory_order_acquire);
+	struct dequearray *a = atomic_load_explicit(&dq->array, memory_order_relaxed);
+
+	if (b - t > a->size - 1) {
+		a = growDeque(dq, a, t, b);
+	}
+	atomic_store_explicit(&a->buf[b & (a->size - 1)], client, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+}
+
+//remove and return client from the bottom
+struct client* dequeTake(struct deque* dq) {
+	long b = atomic_load_explicit(&dq->bottom, memory_order_relaxed) - 1;
+	struct dequearray *a = atomic_load_explicit(&dq->array, memory_order_relaxed);
+	struct client *client = NULL;
+	long t;
+
+	atomic_store_explicit(&dq->bottom, b, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	t = atomic_load_explicit(&dq->top, memory_order_relaxed);
+
+	if (t <= b) {
+		client = atomic_load_explicit(&a->buf[b & (a->size - 1)], memory_order_relaxed);
+		if (t == b) {
+			//last client, race thieves for it
+			if (!atomic_compare_exchange_strong_explicit(&dq->top, &t, t + 1,
+					memory_order_seq_cst, memory_order_relaxed)) {
+				client = NULL;
+			}
+			atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+		}
+	} else {
+		atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+	}
+	return client;
+}
+
+//remove and return client from the top
+struct client* dequeSteal(struct deque* dq) {
+	long t = atomic_load_explicit(&dq->top, memory_order_acquire);
+	struct client *client = NULL;
+	long b;
+
+	atomic_thread_fence(memory_order_seq_cst);
+	b = atomic_load_explicit(&dq->bottom, memory_order_acquire);
+
+	if (t < b) {
+		struct dequearray *a = atomic_load_explicit(&dq->array, memory_order_acquire);
+		client = atomic_load_explicit(&a->buf[t & (a->size - 1)], memory_order_relaxed);
+		if (!atomic_compare_exchange_strong_explicit(&dq->top, &t, t + 1,
+				memory_order_seq_cst, memory_order_relaxed)) {
+			return NULL;
+		}
+	}
+	return client;
+}
+
+//approximate number of clients in the deque
+long dequeSize(struct deque* dq) {
+	long b = atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+	long t = atomic_load_explicit(&dq->top, memory_order_relaxed);
+	return b > t ? b - t : 0;
+}
+
+//initialize injection queue
+void initInject(struct injectq* q, unsigned long size) {
+	q->cells = (struct injectcell*) malloc(sizeof(struct injectcell) * size);
+	if (!q->cells) {
+		perror("Error while allocating memory");
+		abort();
+	}
+	for (unsigned long i = 0; i < size; i++) {
+		atomic_init(&q->cells[i].seq, i);
+	}
+	q->mask = size - 1;
+	atomic_init(&q->head, 0);
+	atomic_init(&q->tail, 0);
+}
+
+//append client; each cell's seq says whether it is free for the push at pos
+int injectPush(struct injectq* q, struct client* client) {
+	unsigned long pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+	struct injectcell *cell;
+
+	for (;;) {
+		cell = &q->cells[pos & q->mask];
+		long diff = (long) atomic_load_explicit(&cell->seq, memory_order_acquire) - (long) pos;
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1,
+					memory_order_relaxed, memory_order_relaxed)) {
+				break;
+			}
+		} else if (diff < 0) {
+			return 0;	//full
+		} else {
+			pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+		}
+	}
+	cell->client = client;
+	atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+	return 1;
+}
+
+//remove and return oldest client
+struct client* injectPop(struct injectq* q) {
+	unsigned long pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	struct injectcell *cell;
+	struct client *client;
+
+	for (;;) {
+		cell = &q->cells[pos & q->mask];
+		long diff = (long) atomic_load_explicit(&cell->seq, memory_order_acquire) - (long) (pos + 1);
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1,
+					memory_order_relaxed, memory_order_relaxed)) {
+				break;
+			}
+		} else if (diff < 0) {
+			return NULL;	//empty
+		} else {
+			pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+		}
+	}
+	client = cell->client;
+	atomic_store_explicit(&cell->seq, pos + q->mask + 1, memory_order_release);
+	return client;
+}
+
+//approximate number of clients in the queue
+long injectSize(struct injectq* q) {
+	unsigned long h = atomic_load_explicit(&q->head, memory_order_relaxed);
+	unsigned long t = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	return h > t ? (long) (h - t) : 0;
+}
+
+//initialize fifo
+void initFifo(struct fifo* q) {
+	pthread_mutex_init(&q->lock, NULL);
+	q->head = NULL;
+	q->tail = NULL;
+	atomic_init(&q->size, 0);
+}
+
+//append client, stamped with the time it joined
+void fifoPush(struct fifo* q, struct client* client, long long now) {
+	client->qnext = NULL;
+	client->queued = now;
+	pthread_mutex_lock(&q->lock);
+	if (q->tail) {
+		q->tail->qnext = client;
+	} else {
+		q->head = client;
+	}
+	q->tail = client;
+	atomic_fetch_add(&q->size, 1);
+	pthread_mutex_unlock(&q->lock);
+}
+
+//remove and return the head if it joined before the given time
+struct client* fifoPopBefore(struct fifo* q, long long before) {
+	struct client *client;
+
+	if (atomic_load(&q->size) == 0) {                //skip the lock when empty
+		return NULL;
+	}
+	pthread_mutex_lock(&q->lock);
+	client = q->head;
+	if (client && client->queued < before) {
+		q->head = client->qnext;
+		if (!q->head) {
+			q->tail = NULL;
+		}
+		atomic_fetch_sub(&q->size, 1);
+	} else {
+		client = NULL;
+	}
+	pthread_mutex_unlock(&q->lock);
+	return client;
+}
+
+//remove and return oldest client, NULL if empty
+struct client* fifoPop(struct fifo* q) {
+	return fifoPopBefore(q, LLONG_MAX);
+}
+
+//number of clients in the fifo, read without the lock
+long fifoSize(struct fifo* q) {
+	return atomic_load(&q->size);
+}
+
 /* test harness */
 /*
 int main() {
@@ -258,25 +630,25 @@ int main() {
 
 	struct client *client2 = (struct client*) malloc(sizeof(struct client));
 	client2->fd = 0;
-	client2->fin = NULL;
+	client2->file = NULL;
 	client2->rem = 3;
 	client2->pos = 2;
 
 	struct client *client3 = (struct client*) malloc(sizeof(struct client));
 	client3->fd = 0;
-	client3->fin = NULL;
+	client3->file = NULL;
 	client3->rem = 6;
 	client3->pos = 3;
 
 	struct client *client4 = (struct client*) malloc(sizeof(struct client));
 	client4->fd = 0;
-	client4->fin = NULL;
+	client4->file = NULL;
 	client4->rem = 3;
 	client4->pos = 1;
 
 	struct client *client5 = (struct client*) malloc(sizeof(struct client));
 	client5->fd = 0;
-	client5->fin = NULL;
+	client5->file = NULL;
 	client5->rem = 5;
 	client5->pos = 2;
 
@@ -1,9 +1,53 @@
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "http.h"
+
+#define XFER_SENDFILE 0		/* send file with sendfile() */
+#define XFER_SPLICE 1		/* send file with splice() through a pipe */
+#define XFER_COPY 2		/* read file into a buffer and write() it */
+
+#define CLIENT_INBUF 8192	/* largest request accepted */
+#define CLIENT_RANGES 16	/* most byte ranges served in one response */
+
+struct fcache_entry;
+struct ccache_obj;
+
 struct client {
-	char *filename;
+	char filename[128];
 	int fd;
-	FILE *fin;
-	int rem;
-	int pos;
+	struct fcache_entry *file;	/* from fcache_open(), NULL until admitted */
+	struct ccache_obj *body;	/* file body in memory, or NULL */
+	char *page;		/* generated body (the stats page), or NULL */
+	const char *hdr;		/* response header not sent yet */
+	int hdrlen;
+	off_t rem;		/* bytes of the body not sent yet */
+	off_t pos;		/* file offset of the next byte */
+	int xfer;		/* fastest transfer method that works for file */
+	int level;		/* MLFB level, 0 is the highest */
+	long deficit;		/* DRR bytes owed to the client */
+	int weight;		/* DRR quanta per turn */
+	struct client *qnext;	/* link in a fifo */
+	struct client *wnext;	/* links among the clients waiting for a request */
+	struct client *wprev;
+	long long queued;	/* when it joined its fifo */
+	char inbuf[CLIENT_INBUF];	/* bytes received */
+	int inoff;		/* start of the bytes not parsed yet */
+	int inlen;		/* end of the bytes received */
+	int inscan;		/* bytes of a partial request already searched */
+	int keepalive;		/* 0 to close after the response */
+	int idle;		/* waiting for its next request */
+	int parked;		/* waiting for its socket to drain */
+	char header[512];	/* response (or part) header being sent */
+	struct http_range ranges[CLIENT_RANGES];	/* parts of a multipart response */
+	int nranges;		/* 0 unless multipart/byteranges */
+	int range;		/* next part to start */
+	long long partrem;	/* bytes of the current part not sent yet */
+	off_t size;		/* bytes of the response body, for stats */
+	long long arrived;	/* stats_now() when the request arrived */
+	long long admitted;	/* ... was admitted to the scheduler */
+	long long started;	/* ... had its first slice, 0 before */
 };
 
 struct node {
@@ -18,9 +62,64 @@ struct linkedlist {
 	int size;
 };
 
+struct heapentry {
+	off_t key;		/* client->rem when inserted */
+	unsigned long seq;	/* insertion order, breaks ties */
+	struct client *client;
+};
+
+/* array backed binary min-heap of clients ordered by bytes remaining */
+struct heap {
+	struct heapentry *entries;
+	atomic_int size;			/* changed under a lock, read without */
+	int capacity;
+	unsigned long seq;
+};
+
+struct dequearray {
+	long size;				/* power of two */
+	_Atomic(struct client*) *buf;
+	struct dequearray *prev;		/* retired arrays, thieves may still read them */
+};
+
+/* Chase-Lev work-stealing deque.  Only the owning thread may push or take;
+ * any thread (the owner included) may steal from the other end. */
+struct deque {
+	_Alignas(64) atomic_long top;
+	_Alignas(64) atomic_long bottom;
+	_Atomic(struct dequearray*) array;
+};
+
+struct injectcell {
+	atomic_ulong seq;
+	struct client *client;
+};
+
+/* bounded lock-free multi-producer multi-consumer FIFO queue */
+struct injectq {
+	struct injectcell *cells;
+	unsigned long mask;
+	_Alignas(64) atomic_ulong head;		/* next cell to push */
+	_Alignas(64) atomic_ulong tail;		/* next cell to pop */
+};
+
+/* unbounded FIFO queue shared by all threads, linked through the clients */
+struct fifo {
+	pthread_mutex_t lock;
+	struct client *head;
+	struct client *tail;
+	atomic_long size;
+};
+
 //initialize client
 void initClient(struct client* client);
 
+//take a client from the calling thread's pool, initialized
+struct client* newClient();
+
+//return a client to its pool
+void freeClient(struct client* client);
+
 //initialize linkedlist
 void initList(struct linkedlist* list);
 
@@ -59,3 +158,60 @@ struct client* delete(struct linkedlist* list, struct client* client);
 
 //sort by size of file to download
 void sort(struct linkedlist* list);
+
+//initialize heap
+void initHeap(struct heap* heap);
+
+//insert client keyed on its remaining bytes, O(log n)
+void heapInsert(struct heap* heap, struct client* client);
+
+//return client with fewest remaining bytes without removing it
+struct client* heapPeek(struct heap* heap);
+
+//remove and return client with fewest remaining bytes (oldest on ties), O(log n)
+struct client* heapPop(struct heap* heap);
+
+//size of heap
+int heapSize(struct heap* heap);
+
+//initialize deque
+void initDeque(struct deque* dq);
+
+//push client on the bottom of the deque (owner only)
+void dequePush(struct deque* dq, struct client* client);
+
+//remove and return client from the bottom, NULL if empty (owner only)
+struct client* dequeTake(struct deque* dq);
+
+//remove and return client from the top, NULL if empty or lost a race (any thread)
+struct client* dequeSteal(struct deque* dq);
+
+//approximate number of clients in the deque
+long dequeSize(struct deque* dq);
+
+//initialize injection queue holding up to size (power of two) clients
+void initInject(struct injectq* q, unsigned long size);
+
+//append client, returns 0 if the queue is full
+int injectPush(struct injectq* q, struct client* client);
+
+//remove and return oldest client, NULL if empty
+struct client* injectPop(struct injectq* q);
+
+//approximate number of clients in the queue
+long injectSize(struct injectq* q);
+
+//initialize fifo
+void initFifo(struct fifo* q);
+
+//append client, stamped with the time it joined
+void fifoPush(struct fifo* q, struct client* client, long long now);
+
+//remove and return oldest client, NULL if empty
+struct client* fifoPop(struct fifo* q);
+
+//remove and return oldest client if it joined before the given time
+struct client* fifoPopBefore(struct fifo* q, long long before);
+
+//number of clients in the fifo, read without the lock
+long fifoSize(struct fifo* q);
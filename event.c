@@ -0,0 +1,110 @@
+/*
+ * File: event.c
+ * Purpose: This file contains the event module used to wait on the listening
+ *          socket and client sockets.  Please see event.h for documentation
+ *          on how to use this module.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "event.h"
+
+/* translate EVENT_* bits into the epoll flags used for a registration */
+static unsigned int event_flags( int events ) {
+  unsigned int flags = EPOLLET | EPOLLRDHUP;            /* always edge trig. */
+
+  if( events & EVENT_READ ) {
+    flags |= EPOLLIN;
+  }
+  if( events & EVENT_WRITE ) {
+    flags |= EPOLLOUT;
+  }
+  if( events & EVENT_ONESHOT ) {
+    flags |= EPOLLONESHOT;
+  }
+  return flags;
+}
+
+
+extern struct event_loop *event_init( int max ) {
+  struct event_loop *loop;
+
+  loop = malloc( sizeof( struct event_loop ) );
+  if( loop ) {
+    loop->scratch = malloc( sizeof( struct epoll_event ) * max );
+  }
+  if( !loop || !loop->scratch ) {                       /* error check */
+    perror( "Error while allocating memory" );
+    abort();
+  }
+
+  loop->max = max;
+  loop->epfd = epoll_create1( EPOLL_CLOEXEC );          /* create instance */
+  if( loop->epfd < 0 ) {
+    perror( "Error while creating event loop" );
+    abort();
+  }
+  return loop;
+}
+
+
+extern int event_add( struct event_loop *loop, int fd, int events, void *data ) {
+  struct epoll_event ev;
+
+  ev.events = event_flags( events );
+  ev.data.ptr = data;
+  return epoll_ctl( loop->epfd, EPOLL_CTL_ADD, fd, &ev );
+}
+
+
+extern int event_rearm( struct event_loop *loop, int fd, int events,
+                        void *data ) {
+  struct epoll_event ev;
+
+  ev.events = event_flags( events );
+  ev.data.ptr = data;
+  return epoll_ctl( loop->epfd, EPOLL_CTL_MOD, fd, &ev );
+}
+
+
+extern void event_del( struct event_loop *loop, int fd ) {
+  struct epoll_event ev;                                /* for old kernels */
+
+  epoll_ctl( loop->epfd, EPOLL_CTL_DEL, fd, &ev );
+}
+
+
+extern int event_wait( struct event_loop *loop, struct event *out,
+                       int timeout ) {
+  struct epoll_event *evs = loop->scratch;
+  int n;
+  int i;
+
+  do {                                                  /* retry on signal */
+    n = epoll_wait( loop->epfd, evs, loop->max, timeout );
+  } while( ( n < 0 ) && ( errno == EINTR ) );
+
+  if( n < 0 ) {                                         /* check for errors */
+    perror( "Error occurred while waiting" );
+    abort();
+  }
+
+  for( i = 0; i < n; i++ ) {                            /* translate events */
+    out[i].data = evs[i].data.ptr;
+    out[i].events = 0;
+    if( evs[i].events & EPOLLIN ) {
+      out[i].events |= EVENT_READ;
+    }
+    if( evs[i].events & EPOLLOUT ) {
+      out[i].events |= EVENT_WRITE;
+    }
+    if( evs[i].events & ( EPOLLERR | EPOLLHUP | EPOLLRDHUP ) ) {
+      out[i].events |= EVENT_CLOSED;
+    }
+  }
+  return n;
+}
@@ -0,0 +1,89 @@
+/*
+ * File: event.h
+ * Purpose: This file contains the prototypes and describes how to use the
+ *          event module to wait for activity on many sockets at once.
+ */
+
+#ifndef EVENT_H
+#define EVENT_H
+
+#define EVENT_READ    0x1                /* socket has data to read */
+#define EVENT_WRITE   0x2                /* socket can accept more data */
+#define EVENT_ONESHOT 0x4                /* disarm after the first event */
+#define EVENT_CLOSED  0x8                /* peer hung up or socket error */
+
+/*
+ * This module wraps an edge-triggered epoll instance:
+ *   event_init()  : create an event loop
+ *   event_add()   : start watching a socket
+ *   event_rearm() : re-enable a one-shot socket after it fired
+ *   event_del()   : stop watching a socket
+ *   event_wait()  : sleep until one or more watched sockets are ready
+ *
+ * Sockets are watched in edge-triggered mode, so a caller woken for a
+ * socket must drain it (read/accept until EAGAIN) or re-arm it.  Sockets
+ * registered with EVENT_ONESHOT are disarmed after reporting once, which
+ * lets the owner of the socket hand it to another thread without a second
+ * wakeup racing in.
+ */
+
+struct event {
+  void *data;                            /* pointer given to event_add() */
+  int events;                            /* EVENT_* bits that fired */
+};
+
+struct event_loop {
+  int epfd;                              /* epoll instance */
+  int max;                               /* size of the scratch array */
+  void *scratch;                         /* kernel event array */
+};
+
+
+/* This function creates an event loop.  This function will abort the
+ *   program if an error occurs.
+ * Parameters:
+ *             max : the most events returned by a single event_wait()
+ * Returns: A pointer to the new event loop
+ */
+extern struct event_loop *event_init( int max );
+
+
+/* This function starts watching a socket.
+ * Parameters:
+ *             loop   : the event loop
+ *             fd     : the socket to watch
+ *             events : EVENT_READ, EVENT_WRITE and/or EVENT_ONESHOT
+ *             data   : pointer returned with each event for this socket
+ * Returns: 0 on success, -1 on error
+ */
+extern int event_add( struct event_loop *loop, int fd, int events, void *data );
+
+
+/* This function re-enables a one-shot socket, possibly for new events.
+ * Parameters: same as event_add()
+ * Returns: 0 on success, -1 on error
+ */
+extern int event_rearm( struct event_loop *loop, int fd, int events,
+                        void *data );
+
+
+/* This function stops watching a socket.
+ * Parameters:
+ *             loop : the event loop
+ *             fd   : the socket to forget
+ * Returns: None
+ */
+extern void event_del( struct event_loop *loop, int fd );
+
+
+/* This function waits for watched sockets to become ready.
+ * Parameters:
+ *             loop    : the event loop
+ *             out     : array of at least loop->max events to fill in
+ *             timeout : milliseconds to wait, or -1 to wait forever
+ * Returns: The number of events stored in out (0 on timeout)
+ */
+extern int event_wait( struct event_loop *loop, struct event *out,
+                       int timeout );
+
+#endif
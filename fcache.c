@@ -0,0 +1,330 @@
+/*
+ * File: fcache.c
+ * Purpose: This file contains the file cache module, which keeps requested
+ *          files open between requests.  Please see fcache.h for
+ *          documentation on how to use this module.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "fcache.h"
+#include "http.h"
+
+#define FCACHE_SHARDS 16                   /* independently locked tables */
+#define FCACHE_WATCH ( IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | \
+                       IN_DELETE_SELF | IN_MOVE_SELF )
+
+struct shard {
+  pthread_mutex_t lock;
+  struct fcache_entry **buckets;         /* hash chains */
+  unsigned int mask;                     /* buckets - 1 */
+  struct fcache_entry *lru;              /* most recently used */
+  struct fcache_entry *lru_tail;         /* least recently used */
+  int count;
+  int capacity;
+};
+
+static struct shard shards[FCACHE_SHARDS];
+static int inotify_fd = -1;
+static atomic_ulong next_id = 1;           /* ids of loaded entries */
+
+
+/* FNV-1a hash of a path */
+static unsigned int hash_path( const char *path ) {
+  unsigned int h = 2166136261u;
+
+  for( ; *path; path++ ) {
+    h = ( h ^ (unsigned char)*path ) * 16777619u;
+  }
+  return h;
+}
+
+
+/* find the entry for path in a locked shard */
+static struct fcache_entry *lookup( struct shard *sh, const char *path,
+                                    unsigned int hash ) {
+  struct fcache_entry *e;
+
+  for( e = sh->buckets[( hash / FCACHE_SHARDS ) & sh->mask]; e; e = e->next ) {
+    if( ( e->hash == hash ) && !strcmp( e->path, path ) ) {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+
+/* move an entry to the front of the recency list of a locked shard */
+static void lru_front( struct shard *sh, struct fcache_entry *e ) {
+  if( sh->lru == e ) {
+    return;
+  }
+  if( e->prev_lru ) {                                   /* unlink */
+    e->prev_lru->next_lru = e->next_lru;
+  }
+  if( e->next_lru ) {
+    e->next_lru->prev_lru = e->prev_lru;
+  } else if( sh->lru_tail == e ) {
+    sh->lru_tail = e->prev_lru;
+  }
+
+  e->prev_lru = NULL;                                   /* push front */
+  e->next_lru = sh->lru;
+  if( sh->lru ) {
+    sh->lru->prev_lru = e;
+  }
+  sh->lru = e;
+  if( !sh->lru_tail ) {
+    sh->lru_tail = e;
+  }
+}
+
+
+/* remove an entry from a locked shard; the caller releases the cache's
+ * reference once the lock is dropped */
+static void unlink_entry( struct shard *sh, struct fcache_entry *e ) {
+  struct fcache_entry **p;
+
+  for( p = &sh->buckets[( e->hash / FCACHE_SHARDS ) & sh->mask]; *p != e;
+       p = &( *p )->next );
+  *p = e->next;
+
+  if( e->prev_lru ) {
+    e->prev_lru->next_lru = e->next_lru;
+  } else {
+    sh->lru = e->next_lru;
+  }
+  if( e->next_lru ) {
+    e->next_lru->prev_lru = e->prev_lru;
+  } else {
+    sh->lru_tail = e->prev_lru;
+  }
+
+  if( e->wd >= 0 ) {                    /* IN_IGNORED drops any aliases */
+    inotify_rm_watch( inotify_fd, e->wd );
+    e->wd = -1;
+  }
+  e->cached = 0;
+  sh->count--;
+}
+
+
+/* open and measure a file; negative entries have fd -1 */
+static struct fcache_entry *load( const char *path, unsigned int hash ) {
+  struct fcache_entry *e;
+  struct stat st;
+
+  e = calloc( 1, sizeof( struct fcache_entry ) );
+  if( !e ) {                                            /* error check */
+    perror( "Error while allocating memory" );
+    abort();
+  }
+  strncpy( e->path, path, FCACHE_PATH - 1 );
+  e->hash = hash;
+  e->id = atomic_fetch_add( &next_id, 1 );
+  e->wd = -1;
+  atomic_init( &e->refs, 1 );                           /* cache's reference */
+
+  e->fd = open( path, O_RDONLY | O_CLOEXEC );
+  if( ( e->fd >= 0 ) && ( fstat( e->fd, &st ) || !S_ISREG( st.st_mode ) ) ) {
+    close( e->fd );                                     /* only plain files */
+    e->fd = -1;
+  }
+
+  if( e->fd < 0 ) {
+    e->expires = time( NULL ) + FCACHE_NEGATIVE_TTL;
+    return e;
+  }
+
+  e->size = st.st_size;
+  e->mtime = st.st_mtime;
+  e->hdrlen = snprintf( e->header, FCACHE_HEADER,
+                        "Content-Length: %lld\r\nContent-Type: %s\r\n"
+                        "Accept-Ranges: bytes\r\n",
+                        (long long)e->size, http_mime( path ) );
+  if( inotify_fd >= 0 ) {
+    e->wd = inotify_add_watch( inotify_fd, path, FCACHE_WATCH );
+  }
+  if( e->wd < 0 ) {                     /* cannot watch it, revalidate */
+    e->expires = time( NULL ) + FCACHE_NEGATIVE_TTL;
+  }
+  return e;
+}
+
+
+extern void fcache_init( int entries ) {
+  int per_shard = entries / FCACHE_SHARDS;
+  unsigned int buckets = 1;
+  int i;
+
+  if( per_shard < 1 ) {
+    per_shard = 1;
+  }
+  while( buckets < (unsigned int)per_shard * 2 ) {      /* load factor <= .5 */
+    buckets *= 2;
+  }
+
+  for( i = 0; i < FCACHE_SHARDS; i++ ) {
+    pthread_mutex_init( &shards[i].lock, NULL );
+    shards[i].buckets = calloc( buckets, sizeof( struct fcache_entry * ) );
+    if( !shards[i].buckets ) {                          /* error check */
+      perror( "Error while allocating memory" );
+      abort();
+    }
+    shards[i].mask = buckets - 1;
+    shards[i].capacity = per_shard;
+  }
+
+  inotify_fd = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+  if( inotify_fd < 0 ) {
+    perror( "Warning, files will be revalidated by timeout" );
+  }
+}
+
+
+extern struct fcache_entry *fcache_open( const char *path ) {
+  unsigned int hash = hash_path( path );
+  struct shard *sh = &shards[hash % FCACHE_SHARDS];
+  struct fcache_entry *victim = NULL;
+  struct fcache_entry *stale = NULL;
+  struct fcache_entry *e;
+
+  if( strlen( path ) >= FCACHE_PATH ) {                 /* too long to cache */
+    e = load( path, hash );
+    if( e->fd < 0 ) {
+      fcache_release( e );
+      return NULL;
+    }
+    return e;
+  }
+
+  pthread_mutex_lock( &sh->lock );
+  e = lookup( sh, path, hash );
+  if( e && e->expires && ( e->expires <= time( NULL ) ) ) {
+    unlink_entry( sh, e );                              /* expired */
+    stale = e;
+    e = NULL;
+  }
+  if( e ) {                                             /* hit */
+    lru_front( sh, e );
+    if( e->fd >= 0 ) {
+      atomic_fetch_add( &e->refs, 1 );
+    }
+  }
+  pthread_mutex_unlock( &sh->lock );
+
+  if( stale ) {
+    fcache_release( stale );
+  }
+  if( e ) {
+    return e->fd >= 0 ? e : NULL;
+  }
+
+  e = load( path, hash );                               /* miss, open it */
+
+  pthread_mutex_lock( &sh->lock );
+  stale = lookup( sh, path, hash );
+  if( stale ) {                                         /* lost a race */
+    fcache_release( e );
+    e = stale;
+    stale = NULL;
+  } else {
+    e->next = sh->buckets[( hash / FCACHE_SHARDS ) & sh->mask];
+    sh->buckets[( hash / FCACHE_SHARDS ) & sh->mask] = e;
+    e->cached = 1;
+    sh->count++;
+    if( sh->count > sh->capacity ) {                    /* evict the LRU */
+      victim = sh->lru_tail;
+      unlink_entry( sh, victim );
+    }
+  }
+  lru_front( sh, e );
+  if( e->fd >= 0 ) {
+    atomic_fetch_add( &e->refs, 1 );
+  }
+  pthread_mutex_unlock( &sh->lock );
+
+  if( victim ) {
+    fcache_release( victim );
+  }
+  return e->fd >= 0 ? e : NULL;
+}
+
+
+extern void fcache_release( struct fcache_entry *entry ) {
+  if( atomic_fetch_sub( &entry->refs, 1 ) == 1 ) {      /* last reference */
+    if( entry->wd >= 0 ) {                              /* never cached */
+      inotify_rm_watch( inotify_fd, entry->wd );
+    }
+    if( entry->fd >= 0 ) {
+      close( entry->fd );
+    }
+    free( entry );
+  }
+}
+
+
+extern int fcache_fd() {
+  return inotify_fd;
+}
+
+
+/* drop every entry watched by wd */
+static void invalidate( int wd ) {
+  struct fcache_entry *dropped = NULL;
+  struct fcache_entry *e;
+  struct fcache_entry *next;
+  int i;
+
+  for( i = 0; i < FCACHE_SHARDS; i++ ) {
+    pthread_mutex_lock( &shards[i].lock );
+    for( e = shards[i].lru; e; e = next ) {
+      next = e->next_lru;
+      if( e->wd == wd ) {
+        e->wd = -1;                                     /* watch is gone */
+        unlink_entry( &shards[i], e );
+        e->next = dropped;                              /* release later */
+        dropped = e;
+      }
+    }
+    pthread_mutex_unlock( &shards[i].lock );
+  }
+
+  if( dropped ) {                                       /* stop watching */
+    inotify_rm_watch( inotify_fd, wd );
+  }
+  for( e = dropped; e; e = next ) {
+    next = e->next;
+    fcache_release( e );
+  }
+}
+
+
+extern void fcache_process() {
+  char buf[4096] __attribute__(( aligned( __alignof__( struct inotify_event ) ) ));
+  struct inotify_event *ev;
+  ssize_t len;
+  char *p;
+
+  if( inotify_fd < 0 ) {
+    return;
+  }
+
+  while( ( len = read( inotify_fd, buf, sizeof( buf ) ) ) > 0 ) {
+    for( p = buf; p < buf + len; p += sizeof( *ev ) + ev->len ) {
+      ev = (struct inotify_event *)p;
+      invalidate( ev->wd );
+    }
+  }
+  if( ( len < 0 ) && ( errno != EAGAIN ) && ( errno != EINTR ) ) {
+    perror( "Error reading file change events" );
+  }
+}
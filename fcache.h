@@ -0,0 +1,108 @@
+/*
+ * File: fcache.h
+ * Purpose: This file contains the prototypes and describes how to use the
+ *          file cache module, which keeps requested files open between
+ *          requests.
+ */
+
+#ifndef FCACHE_H
+#define FCACHE_H
+
+#include <time.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+
+#define FCACHE_ENTRIES 1024                /* default number of entries */
+#define FCACHE_PATH 128                    /* longest cached path + 1 */
+#define FCACHE_NEGATIVE_TTL 1              /* seconds a 404 is remembered */
+#define FCACHE_HEADER 128                  /* room for the response fields */
+
+/*
+ * This module maps request paths to open file descriptors:
+ *   fcache_init()    : initializes the module
+ *   fcache_open()    : look up (or open) the file for a request path
+ *   fcache_release() : drop a reference returned by fcache_open()
+ *   fcache_fd()      : descriptor that becomes readable when files change
+ *   fcache_process() : invalidate the entries of files that changed
+ *
+ * Each entry holds an open descriptor with the file's size and mtime, so a
+ * popular file is opened and measured once rather than on every request.
+ * The entry also holds the Content-Length and Content-Type lines of the
+ * response header, formatted when the file is opened.
+ * Entries are reference counted: an entry evicted or invalidated while a
+ * client is still sending from it stays open until that client releases
+ * it.  Transfers must use positioned I/O (sendfile() with an offset,
+ * pread()) because the descriptor is shared.
+ *
+ * Files that do not exist are cached as negative entries for
+ * FCACHE_NEGATIVE_TTL seconds, so repeated 404s cost no system calls.
+ * Existing files are watched with inotify; the owner of an event loop
+ * should watch fcache_fd() for reading and call fcache_process() when it
+ * fires.  If inotify is unavailable, entries simply expire after
+ * FCACHE_NEGATIVE_TTL seconds.
+ */
+
+struct fcache_entry {
+  char path[FCACHE_PATH];                /* request path, the key */
+  unsigned long id;                      /* unique per load of a file */
+  int fd;                                /* open file */
+  off_t size;                            /* size in bytes */
+  time_t mtime;                          /* last modification */
+  char header[FCACHE_HEADER];            /* response fields for the file */
+  int hdrlen;
+  time_t expires;                        /* 0 if valid until invalidated */
+  int wd;                                /* inotify watch, or -1 */
+  atomic_int refs;                       /* cache's reference + clients' */
+  int cached;                            /* still in the table */
+  unsigned int hash;
+  struct fcache_entry *next;             /* hash chain */
+  struct fcache_entry *prev_lru;         /* recency list of the shard */
+  struct fcache_entry *next_lru;
+};
+
+
+/* This function initializes the file cache.  This function will abort the
+ *   program if an error occurs.
+ * Parameters:
+ *             entries : the most files (and 404s) to remember
+ * Returns: None
+ */
+extern void fcache_init( int entries );
+
+
+/* This function returns the cache entry for a request path, opening the
+ *    file if it is not cached yet.
+ * Parameters:
+ *             path : the path of the file, relative to the working directory
+ * Returns: A referenced entry, which must be passed to fcache_release()
+ *          when the caller is done with it, or NULL if the file cannot be
+ *          opened
+ */
+extern struct fcache_entry *fcache_open( const char *path );
+
+
+/* This function drops a reference returned by fcache_open().  The file is
+ *    closed once the entry is no longer cached or referenced.
+ * Parameters:
+ *             entry : the entry
+ * Returns: None
+ */
+extern void fcache_release( struct fcache_entry *entry );
+
+
+/* This function returns the inotify descriptor of the cache.
+ * Parameters: None
+ * Returns: A non-blocking descriptor to watch for reading, or -1 if files
+ *          are not being watched
+ */
+extern int fcache_fd();
+
+
+/* This function reads pending inotify events and drops the entries of the
+ *    files that changed, so the next request opens them again.
+ * Parameters: None
+ * Returns: None
+ */
+extern void fcache_process();
+
+#endif
@@ -0,0 +1,378 @@
+/*
+ * File: http.c
+ * Purpose: This file contains the HTTP module, which parses requests in
+ *          place in a receive buffer.  Please see http.h for documentation
+ *          on how to use this module.
+ */
+
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <immintrin.h>
+#define HTTP_X86
+#endif
+
+#include "http.h"
+
+typedef const char *( *find_fn )( const char *p, const char *end );
+
+struct mime {
+  const char *ext;
+  const char *type;
+};
+
+static const struct mime mime_types[] = {
+  { "html", "text/html; charset=utf-8" },
+  { "htm", "text/html; charset=utf-8" },
+  { "txt", "text/plain; charset=utf-8" },
+  { "in", "text/plain; charset=utf-8" },
+  { "c", "text/plain; charset=utf-8" },
+  { "h", "text/plain; charset=utf-8" },
+  { "css", "text/css" },
+  { "js", "text/javascript" },
+  { "json", "application/json" },
+  { "xml", "application/xml" },
+  { "pdf", "application/pdf" },
+  { "zip", "application/zip" },
+  { "gz", "application/gzip" },
+  { "png", "image/png" },
+  { "jpg", "image/jpeg" },
+  { "jpeg", "image/jpeg" },
+  { "gif", "image/gif" },
+  { "svg", "image/svg+xml" },
+  { "ico", "image/x-icon" },
+  { "webp", "image/webp" },
+  { "mp3", "audio/mpeg" },
+  { "mp4", "video/mp4" },
+  { "webm", "video/webm" },
+  { "woff2", "font/woff2" },
+};
+
+
+/* first '\n' in [p, end), or end if there is none */
+static const char *find_newline_scalar( const char *p, const char *end ) {
+  for( ; p < end; p++ ) {
+    if( *p == '\n' ) {
+      return p;
+    }
+  }
+  return end;
+}
+
+
+#ifdef HTTP_X86
+/* first '\n' in [p, end), comparing 16 bytes at a time */
+__attribute__(( target( "sse2" ) ))
+static const char *find_newline_sse2( const char *p, const char *end ) {
+  const __m128i nl = _mm_set1_epi8( '\n' );
+  unsigned int mask;
+
+  for( ; end - p >= 16; p += 16 ) {
+    mask = _mm_movemask_epi8( _mm_cmpeq_epi8(
+             _mm_loadu_si128( (const __m128i *)p ), nl ) );
+    if( mask ) {
+      return p + __builtin_ctz( mask );
+    }
+  }
+  return find_newline_scalar( p, end );                 /* the tail */
+}
+
+
+/* first '\n' in [p, end), comparing 32 bytes at a time */
+__attribute__(( target( "avx2" ) ))
+static const char *find_newline_avx2( const char *p, const char *end ) {
+  const __m256i nl = _mm256_set1_epi8( '\n' );
+  unsigned int mask;
+
+  for( ; end - p >= 32; p += 32 ) {
+    mask = _mm256_movemask_epi8( _mm256_cmpeq_epi8(
+             _mm256_loadu_si256( (const __m256i *)p ), nl ) );
+    if( mask ) {
+      return p + __builtin_ctz( mask );
+    }
+  }
+  return find_newline_sse2( p, end );                   /* the tail */
+}
+
+static find_fn find_newline = find_newline_sse2;
+#else
+static find_fn find_newline = find_newline_scalar;
+#endif
+
+
+extern int http_init( int simd ) {
+#ifdef HTTP_X86
+  __builtin_cpu_init();
+  if( ( simd >= HTTP_SIMD_AVX2 ) && __builtin_cpu_supports( "avx2" ) ) {
+    find_newline = find_newline_avx2;
+    return HTTP_SIMD_AVX2;
+  } else if( ( simd >= HTTP_SIMD_SSE2 ) && __builtin_cpu_supports( "sse2" ) ) {
+    find_newline = find_newline_sse2;
+    return HTTP_SIMD_SSE2;
+  }
+#endif
+  find_newline = find_newline_scalar;
+  return HTTP_SIMD_NONE;
+}
+
+
+/* a view of [p, end) without blanks at either end */
+static struct http_view trim( const char *p, const char *end ) {
+  struct http_view v;
+
+  while( ( p < end ) && ( *p == ' ' || *p == '\t' ) ) {
+    p++;
+  }
+  while( ( end > p ) && ( end[-1] == ' ' || end[-1] == '\t' ||
+                          end[-1] == '\r' ) ) {
+    end--;
+  }
+  v.ptr = p;
+  v.len = end - p;
+  return v;
+}
+
+
+/* parse the request line in [p, end), without its line end */
+static int parse_request_line( const char *p, const char *end,
+                               struct http_request *req ) {
+  const char *sp;
+  struct http_view version;
+
+  sp = memchr( p, ' ', end - p );                       /* method */
+  if( !sp || ( sp == p ) ) {
+    return HTTP_ERROR;
+  }
+  req->method.ptr = p;
+  req->method.len = sp - p;
+
+  for( p = sp + 1; ( p < end ) && ( *p == ' ' ); p++ );
+  sp = memchr( p, ' ', end - p );                       /* path */
+  if( !sp ) {
+    sp = end;
+  }
+  req->path = trim( p, sp );
+  if( !req->path.len ) {
+    return HTTP_ERROR;
+  }
+
+  version = trim( sp, end );                            /* protocol */
+  if( !version.len ) {
+    req->minor = -1;
+  } else if( ( version.len == 8 ) && !memcmp( version.ptr, "HTTP/1.", 7 ) &&
+             ( version.ptr[7] >= '0' ) && ( version.ptr[7] <= '9' ) ) {
+    req->minor = version.ptr[7] - '0';
+  } else {
+    return HTTP_ERROR;
+  }
+  return 0;
+}
+
+
+/* parse the header line in [p, end), without its line end */
+static int parse_header( const char *p, const char *end,
+                         struct http_request *req ) {
+  const char *colon = memchr( p, ':', end - p );
+  struct http_header *h;
+
+  if( !colon || ( colon == p ) || ( colon[-1] == ' ' ) ||
+      ( req->nheaders == HTTP_MAX_HEADERS ) ) {
+    return HTTP_ERROR;
+  }
+  h = &req->headers[req->nheaders++];
+  h->name.ptr = p;
+  h->name.len = colon - p;
+  h->value = trim( colon + 1, end );
+  return 0;
+}
+
+
+extern int http_parse( const char *buf, int len, int *scanned,
+                       struct http_request *req ) {
+  const char *end = buf + len;
+  const char *start = buf;
+  const char *line;
+  const char *nl;
+  const char *last = NULL;                              /* blank line's '\n' */
+
+  while( ( start < end ) && ( *start == '\r' || *start == '\n' ) ) {
+    start++;                                            /* stray line ends */
+  }
+
+  /* find the blank line, resuming where the last call stopped; a '\n'
+   * ends the request if the line it ends is empty ("\n\n" or "\n\r\n") */
+  nl = buf + *scanned > start ? buf + *scanned : start;
+  for( ; ( nl = find_newline( nl, end ) ) < end; nl++ ) {
+    if( ( nl - 1 >= start ) && ( nl[-1] == '\n' ) ) {
+      last = nl;
+      break;
+    } else if( ( nl - 2 >= start ) && ( nl[-1] == '\r' ) && ( nl[-2] == '\n' ) ) {
+      last = nl;
+      break;
+    }
+  }
+  if( !last ) {
+    *scanned = len;
+    return HTTP_INCOMPLETE;
+  }
+
+  /* the whole head is here: split it into lines */
+  req->nheaders = 0;
+  for( line = start; line < last; line = nl + 1 ) {
+    nl = find_newline( line, last );
+    if( line == start ) {
+      if( parse_request_line( line, nl, req ) ) {
+        return HTTP_ERROR;
+      }
+    } else if( ( nl - line > 1 ) || ( ( nl - line == 1 ) && ( *line != '\r' ) ) ) {
+      if( parse_header( line, nl, req ) ) {
+        return HTTP_ERROR;
+      }
+    }
+  }
+  return last + 1 - buf;
+}
+
+
+extern const struct http_view *http_header( const struct http_request *req,
+                                            const char *name ) {
+  int len = strlen( name );
+  int i;
+
+  for( i = 0; i < req->nheaders; i++ ) {
+    if( ( req->headers[i].name.len == len ) &&
+        !strncasecmp( req->headers[i].name.ptr, name, len ) ) {
+      return &req->headers[i].value;
+    }
+  }
+  return NULL;
+}
+
+
+extern int http_token( const struct http_view *value, const char *token ) {
+  const char *p = value->ptr;
+  const char *end = value->ptr + value->len;
+  const char *comma;
+  struct http_view item;
+  int len = strlen( token );
+
+  for( ; p < end; p = comma + 1 ) {
+    comma = memchr( p, ',', end - p );
+    if( !comma ) {
+      comma = end;
+    }
+    item = trim( p, comma );
+    if( ( item.len == len ) && !strncasecmp( item.ptr, token, len ) ) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+
+/* parse the decimal number at the front of [*p, end), moving *p past it;
+ * returns -1 if there is no number there */
+static long long number( const char **p, const char *end ) {
+  long long n = -1;
+
+  for( ; ( *p < end ) && ( **p >= '0' ) && ( **p <= '9' ); ( *p )++ ) {
+    if( n > ( 1LL << 56 ) ) {                           /* absurdly large */
+      return -1;
+    }
+    n = ( n < 0 ? 0 : n * 10 ) + ( **p - '0' );
+  }
+  return n;
+}
+
+
+extern int http_ranges( const struct http_view *value, long long size,
+                        struct http_range *ranges, int max ) {
+  const char *p = value->ptr;
+  const char *end = value->ptr + value->len;
+  const char *comma;
+  struct http_view item;
+  long long first;
+  long long last;
+  int items = 0;
+  int n = 0;
+
+  if( ( value->len < 6 ) || strncasecmp( p, "bytes=", 6 ) ) {
+    return -1;                                          /* other units */
+  }
+
+  for( p += 6; p < end; p = comma + 1 ) {
+    comma = memchr( p, ',', end - p );
+    if( !comma ) {
+      comma = end;
+    }
+    item = trim( p, comma );
+    if( !item.len ) {                                   /* empty list item */
+      continue;
+    }
+    if( ++items > max ) {
+      return -1;
+    }
+
+    p = item.ptr;
+    first = number( &p, item.ptr + item.len );
+    if( ( p == item.ptr + item.len ) || ( *p++ != '-' ) ) {
+      return -1;
+    }
+    last = number( &p, item.ptr + item.len );
+    if( ( p != item.ptr + item.len ) || ( ( first < 0 ) && ( last < 0 ) ) ||
+        ( ( first >= 0 ) && ( last >= 0 ) && ( last < first ) ) ) {
+      return -1;
+    }
+
+    if( first < 0 ) {                                   /* last bytes */
+      if( ( last == 0 ) || ( size == 0 ) ) {
+        continue;
+      }
+      first = last < size ? size - last : 0;
+      last = size - 1;
+    } else if( first >= size ) {                        /* not satisfiable */
+      continue;
+    } else if( ( last < 0 ) || ( last >= size ) ) {
+      last = size - 1;
+    }
+    ranges[n].start = first;
+    ranges[n].len = last - first + 1;
+    n++;
+  }
+  return items ? n : -1;
+}
+
+extern const char *http_date( int *len ) {
+  static __thread char line[64];
+  static __thread time_t formatted = -1;
+  static __thread int linelen;
+  time_t t = time( NULL );
+  struct tm tm;
+
+  if( t != formatted ) {                                /* new second */
+    gmtime_r( &t, &tm );
+    linelen = strftime( line, sizeof( line ),
+                        "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm );
+    formatted = t;
+  }
+  *len = linelen;
+  return line;
+}
+
+
+extern const char *http_mime( const char *path ) {
+  const char *dot = strrchr( path, '.' );
+  unsigned int i;
+
+  if( dot && !strchr( dot, '/' ) ) {
+    for( i = 0; i < sizeof( mime_types ) / sizeof( mime_types[0] ); i++ ) {
+      if( !strcasecmp( dot + 1, mime_types[i].ext ) ) {
+        return mime_types[i].type;
+      }
+    }
+  }
+  return "application/octet-stream";
+}
@@ -0,0 +1,147 @@
+/*
+ * File: http.h
+ * Purpose: This file contains the prototypes and describes how to use the
+ *          HTTP module, which parses requests in place in a receive buffer.
+ */
+
+#ifndef HTTP_H
+#define HTTP_H
+
+#define HTTP_MAX_HEADERS 32                /* more than this is an error */
+#define HTTP_INCOMPLETE 0                  /* http_parse(): need more bytes */
+#define HTTP_ERROR -1                      /* http_parse(): malformed request */
+
+#define HTTP_SIMD_NONE 0                   /* byte at a time */
+#define HTTP_SIMD_SSE2 1                   /* 16 bytes at a time */
+#define HTTP_SIMD_AVX2 2                   /* 32 bytes at a time */
+#define HTTP_SIMD_BEST 3                   /* whatever the CPU supports */
+
+/*
+ * This module parses HTTP/0.9, 1.0 and 1.1 request heads:
+ *   http_init()   : pick the delimiter search for this CPU
+ *   http_parse()  : parse the request at the front of a buffer
+ *   http_header() : find a header of a parsed request
+ *   http_token()  : does a header value list a token?
+ *   http_ranges() : parse the byte ranges of a Range header
+ *
+ * and two functions for building responses:
+ *   http_date()   : the Date header for the current second
+ *   http_mime()   : the Content-Type of a file, from its extension
+ *
+ * The parser does not copy anything: the method, path and headers of a
+ * parsed request are views (pointer and length) into the caller's buffer,
+ * and stay valid until the caller reuses those bytes.  Lines may end with
+ * CRLF or a bare LF.
+ *
+ * A request may arrive in pieces.  http_parse() returns HTTP_INCOMPLETE
+ * until the blank line ending the request is buffered, and records how far
+ * it searched, so each byte is looked at once no matter how many reads
+ * the request takes.  Line ends are found 16 or 32 bytes at a time with
+ * SSE2 or AVX2 where the CPU has them.
+ */
+
+struct http_view {
+  const char *ptr;                       /* into the receive buffer */
+  int len;
+};
+
+struct http_header {
+  struct http_view name;
+  struct http_view value;                /* without surrounding blanks */
+};
+
+struct http_range {
+  long long start;                       /* first byte */
+  long long len;                         /* bytes from start */
+};
+
+struct http_request {
+  struct http_view method;
+  struct http_view path;
+  int minor;                             /* HTTP/1.minor, -1 for HTTP/0.9 */
+  int nheaders;
+  struct http_header headers[HTTP_MAX_HEADERS];
+};
+
+
+/* This function selects how line ends are searched for.  The default is
+ *   SSE2 on x86-64 and HTTP_SIMD_NONE elsewhere.
+ * Parameters:
+ *             simd : the widest HTTP_SIMD_* level to use
+ * Returns: The level selected, which is lower than simd if the CPU (or the
+ *          compiler) lacks the instructions
+ */
+extern int http_init( int simd );
+
+
+/* This function parses the request at the front of a buffer.
+ * Parameters:
+ *             buf     : the received bytes
+ *             len     : the number of bytes in buf
+ *             scanned : bytes of buf searched by an earlier call that
+ *                       returned HTTP_INCOMPLETE, 0 for a new request;
+ *                       updated when HTTP_INCOMPLETE is returned
+ *             req     : filled in with views into buf
+ * Returns: The length of the request, including the blank line that ends
+ *          it, HTTP_INCOMPLETE if more bytes are needed, or HTTP_ERROR if
+ *          the request is malformed
+ */
+extern int http_parse( const char *buf, int len, int *scanned,
+                       struct http_request *req );
+
+
+/* This function finds a header of a parsed request.
+ * Parameters:
+ *             req  : the request
+ *             name : the header name, matched without regard to case
+ * Returns: The value of the first such header, or NULL if there is none
+ */
+extern const struct http_view *http_header( const struct http_request *req,
+                                            const char *name );
+
+
+/* This function checks a comma separated header value for a token, such
+ *    as "close" in a Connection header.
+ * Parameters:
+ *             value : the header value
+ *             token : the token, matched without regard to case
+ * Returns: 1 if the value lists the token, 0 otherwise
+ */
+extern int http_token( const struct http_view *value, const char *token );
+
+
+/* This function parses the value of a Range header, such as
+ *    "bytes=0-499, 1000-, -200", against the size of the file.  Ranges
+ *    that start beyond the end of the file are left out; ranges that run
+ *    past it are cut short.
+ * Parameters:
+ *             value  : the header value
+ *             size   : the size of the file
+ *             ranges : filled in with the satisfiable ranges, in order
+ *             max    : the most ranges to accept
+ * Returns: The number of satisfiable ranges, 0 if there are none (the
+ *          response is 416), or -1 if the header is malformed, not in
+ *          bytes, or lists more than max ranges (the header is ignored)
+ */
+extern int http_ranges( const struct http_view *value, long long size,
+                        struct http_range *ranges, int max );
+
+
+/* This function returns the Date header line for the current time.  The
+ *    line is formatted at most once per second by each thread.
+ * Parameters:
+ *             len : set to the length of the line
+ * Returns: The line, including its CRLF, in a buffer owned by the calling
+ *          thread
+ */
+extern const char *http_date( int *len );
+
+
+/* This function looks up the media type of a file by its extension.
+ * Parameters:
+ *             path : the path of the file
+ * Returns: The media type, application/octet-stream if it is not known
+ */
+extern const char *http_mime( const char *path );
+
+#endif
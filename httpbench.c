@@ -0,0 +1,124 @@
+/*
+ * File: httpbench.c
+ * Purpose: This file contains a microbenchmark of the HTTP module.  It
+ *          parses a few typical requests many times with each delimiter
+ *          search the CPU supports, both with the request fully buffered
+ *          and arriving in small pieces, and prints the time per request.
+ *
+ *          usage: ./httpbench [ITERATIONS]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "http.h"
+
+#define ITERATIONS 1000000                 /* default parses per case */
+#define PIECE 16                           /* bytes per read when split */
+
+struct sample {
+  const char *name;
+  const char *text;
+};
+
+static const struct sample samples[] = {
+  { "hydra", "GET /test.txt HTTP/1.1\nHost: localhost\n\n" },
+  { "curl", "GET /index.html HTTP/1.1\r\nHost: localhost:38080\r\n"
+            "User-Agent: curl/8.5.0\r\nAccept: */*\r\n\r\n" },
+  { "browser", "GET /images/logo-large.png HTTP/1.1\r\n"
+               "Host: www.example.com\r\n"
+               "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) "
+               "Gecko/20100101 Firefox/128.0\r\n"
+               "Accept: image/avif,image/webp,image/png,image/svg+xml,"
+               "image/*;q=0.8,*/*;q=0.5\r\n"
+               "Accept-Language: en-US,en;q=0.5\r\n"
+               "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+               "Referer: https://www.example.com/products/index.html\r\n"
+               "Cookie: session=8f14e45fceea167a5a36dedd4bea2543; "
+               "theme=dark; consent=1\r\n"
+               "Connection: keep-alive\r\n"
+               "Sec-Fetch-Dest: image\r\nSec-Fetch-Mode: no-cors\r\n"
+               "Sec-Fetch-Site: same-origin\r\nPriority: u=5, i\r\n\r\n" },
+};
+
+static const char *levels[] = { "scalar", "sse2", "avx2" };
+static volatile int sink;                  /* keeps results alive */
+
+
+/* nanoseconds on the monotonic clock */
+static double now() {
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+/* parse a fully buffered request n times; returns ns per request */
+static double bench_whole( const char *text, int len, long n ) {
+  struct http_request req;
+  double start = now();
+  int scanned;
+  long i;
+
+  for( i = 0; i < n; i++ ) {
+    scanned = 0;
+    sink += http_parse( text, len, &scanned, &req );
+  }
+  return ( now() - start ) / n;
+}
+
+
+/* parse a request that arrives PIECE bytes at a time n times; returns ns
+ * per request */
+static double bench_split( const char *text, int len, long n ) {
+  struct http_request req;
+  double start = now();
+  int scanned;
+  int have;
+  int r;
+  long i;
+
+  for( i = 0; i < n; i++ ) {
+    scanned = 0;
+    have = 0;
+    do {
+      have = have + PIECE < len ? have + PIECE : len;
+      r = http_parse( text, have, &scanned, &req );
+    } while( r == HTTP_INCOMPLETE );
+    sink += r;
+  }
+  return ( now() - start ) / n;
+}
+
+
+int main( int argc, char **argv ) {
+  long n = ITERATIONS;
+  int top;
+  int level;
+  unsigned int i;
+
+  if( argc > 1 ) {
+    n = strtol( argv[1], NULL, 10 );
+  }
+
+  top = http_init( HTTP_SIMD_BEST );
+  printf( "%-8s %-8s %-6s %6s %10s %10s\n", "search", "request", "mode",
+          "bytes", "ns/req", "MB/s" );
+  for( level = HTTP_SIMD_NONE; level <= top; level++ ) {
+    http_init( level );
+    for( i = 0; i < sizeof( samples ) / sizeof( samples[0] ); i++ ) {
+      int len = strlen( samples[i].text );
+      double whole = bench_whole( samples[i].text, len, n );
+      double split = bench_split( samples[i].text, len, n );
+
+      printf( "%-8s %-8s %-6s %6d %10.1f %10.1f\n", levels[level],
+              samples[i].name, "whole", len, whole, len * 1e3 / whole );
+      printf( "%-8s %-8s %-6s %6d %10.1f %10.1f\n", levels[level],
+              samples[i].name, "split", len, split, len * 1e3 / split );
+    }
+  }
+  return 0;
+}
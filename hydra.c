@@ -0,0 +1,582 @@
+/*
+ * File: hydra.c
+ * Purpose: This file contains hydra, a load generator for testing the web
+ *          server.  Unlike hydra.py it runs every connection from one
+ *          thread with epoll, so it can keep thousands of connections open
+ *          without distorting the times it measures.
+ *
+ *          usage: ./hydra [-t] [-h HOST] [-c CLIENTS | -r RATE] [-d SECONDS]
+ *                         [-n REQUESTS] [-s SEED] < test.in
+ *
+ *          The test script is the one hydra.py reads: the first line is the
+ *          port of the server, and every other line is a request given as
+ *              delay pause file
+ *          where delay is the number of seconds (from the start of the run)
+ *          before connecting and pause the number of seconds after
+ *          connecting before the request is sent.
+ *
+ *          Without -c or -r the script is replayed as written.  With -c
+ *          (closed loop) CLIENTS connections each send a request as soon as
+ *          their previous one completes; with -r (open loop) requests
+ *          arrive at RATE per second with exponentially distributed gaps,
+ *          whether or not earlier ones have completed.  Both run for -d
+ *          seconds, or until -n requests were started (10 seconds if
+ *          neither is given), and pick the file of each request at random
+ *          from the script's lines, so a script listing small and large
+ *          files is a file size mix.
+ *
+ *          At the end hydra reports the throughput and latency of the run.
+ *          Latency is measured from when the request was sent (scripts),
+ *          when the connection was opened (closed loop) or when the request
+ *          was due to arrive (open loop, so a slow server cannot hide its
+ *          queueing delay by slowing down the arrivals).  -t also prints
+ *          the time of every request in the order they complete.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#define MAX_FILE 256                       /* longest path in a script */
+#define MAX_EVENTS 256                     /* events handled per wakeup */
+#define GRACE 10.0                         /* seconds to wait for stragglers */
+#define RECV_SIZE 65536                    /* bytes read at a time */
+
+#define MODE_SCRIPT 0                      /* replay the script */
+#define MODE_CLOSED 1                      /* fixed number of clients */
+#define MODE_OPEN 2                        /* Poisson arrivals */
+
+#define STATE_CONNECTING 0                 /* connect() in progress */
+#define STATE_PAUSED 1                     /* connected, waiting to send */
+#define STATE_SENDING 2                    /* request partly sent */
+#define STATE_RECEIVING 3                  /* reading the response */
+
+struct entry {
+  double delay;                            /* seconds from start to connect */
+  double pause;                            /* seconds from connect to send */
+  char file[MAX_FILE];
+  int line;                                /* position in the script */
+};
+
+struct conn {
+  int fd;
+  int state;
+  int seq;                                 /* request number, from 1 */
+  const struct entry *entry;
+  double start;                            /* latency is measured from here */
+  double due;                              /* when the pause ends */
+  char req[MAX_FILE + 64];
+  int reqlen;
+  int sent;
+  long long bytes;                         /* response bytes received */
+  char status[16];                         /* start of the status line */
+};
+
+/* connections waiting for their pause to end, ordered by due */
+struct timers {
+  struct conn **heap;
+  int size;
+  int capacity;
+};
+
+static struct entry *entries;              /* the script */
+static int nentries;
+static struct addrinfo *server;            /* where to connect */
+static int epfd;
+static struct timers timers;
+static double *latencies;                  /* of completed requests, in s */
+static long nlatencies;
+static long capacity;
+static long started;                       /* requests begun */
+static long active;                        /* connections open */
+static long failed;                        /* could not connect or reset */
+static long non2xx;                        /* completed, but not 2xx */
+static long long total_bytes;
+static int print_times;                    /* -t */
+static unsigned short seed[3];             /* for erand48() */
+
+
+/* seconds on the monotonic clock */
+static double now() {
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void *checked( void *p ) {
+  if( !p ) {                                            /* error check */
+    perror( "Error while allocating memory" );
+    exit( 1 );
+  }
+  return p;
+}
+
+
+static void timer_swap( int i, int j ) {
+  struct conn *t = timers.heap[i];
+
+  timers.heap[i] = timers.heap[j];
+  timers.heap[j] = t;
+}
+
+
+/* wait until c->due before sending c's request */
+static void timer_add( struct conn *c ) {
+  int i;
+
+  if( timers.size == timers.capacity ) {                /* grow */
+    timers.capacity = timers.capacity ? timers.capacity * 2 : 64;
+    timers.heap = checked( realloc( timers.heap,
+                                    timers.capacity * sizeof( struct conn * ) ) );
+  }
+  i = timers.size++;
+  timers.heap[i] = c;
+  for( ; ( i > 0 ) && ( timers.heap[( i - 1 ) / 2]->due > c->due ); i = ( i - 1 ) / 2 ) {
+    timer_swap( i, ( i - 1 ) / 2 );
+  }
+}
+
+
+/* remove and return the connection whose pause ends first */
+static struct conn *timer_pop() {
+  struct conn *first = timers.heap[0];
+  int i = 0;
+  int child;
+
+  timer_swap( 0, --timers.size );
+  for( ; ( child = 2 * i + 1 ) < timers.size; i = child ) {
+    if( ( child + 1 < timers.size ) &&
+        ( timers.heap[child + 1]->due < timers.heap[child]->due ) ) {
+      child++;
+    }
+    if( timers.heap[i]->due <= timers.heap[child]->due ) {
+      break;
+    }
+    timer_swap( i, child );
+  }
+  return first;
+}
+
+
+/* script order: by delay, then as written */
+static int by_delay( const void *a, const void *b ) {
+  const struct entry *x = a;
+  const struct entry *y = b;
+
+  if( x->delay != y->delay ) {
+    return x->delay < y->delay ? -1 : 1;
+  }
+  return x->line - y->line;
+}
+
+
+/* read the script from stdin, sorted by delay; returns the port */
+static int read_script() {
+  char line[MAX_FILE + 64];
+  int port = 0;
+  int cap = 0;
+  struct entry e;
+
+  if( !fgets( line, sizeof( line ), stdin ) || ( port = atoi( line ) ) <= 0 ) {
+    fprintf( stderr, "The script must start with the port of the server\n" );
+    exit( 1 );
+  }
+  while( fgets( line, sizeof( line ), stdin ) ) {
+    if( sscanf( line, "%lf %lf %255s", &e.delay, &e.pause, e.file ) != 3 ) {
+      continue;                                         /* as hydra.py does */
+    }
+    if( nentries == cap ) {
+      cap = cap ? cap * 2 : 64;
+      entries = checked( realloc( entries, cap * sizeof( struct entry ) ) );
+    }
+    e.line = nentries;
+    entries[nentries++] = e;
+  }
+  if( !nentries ) {
+    fprintf( stderr, "The script has no requests\n" );
+    exit( 1 );
+  }
+  qsort( entries, nentries, sizeof( struct entry ), by_delay );
+  return port;
+}
+
+
+static void record( double latency ) {
+  if( nlatencies == capacity ) {
+    capacity = capacity ? capacity * 2 : 4096;
+    latencies = checked( realloc( latencies, capacity * sizeof( double ) ) );
+  }
+  latencies[nlatencies++] = latency;
+}
+
+
+/* close a connection; complete is set if its response was read in full */
+static void finish( struct conn *c, int complete ) {
+  double latency = now() - c->start;
+
+  close( c->fd );
+  active--;
+  if( !complete ) {
+    failed++;
+  } else {
+    record( latency );
+    total_bytes += c->bytes;
+    if( strncmp( c->status + 8, " 2", 2 ) ) {           /* "HTTP/1.1 200" */
+      non2xx++;
+    }
+    if( print_times ) {
+      printf( "%6d %10.7f seconds %10lld bytes %s\n", c->seq, latency,
+              c->bytes, c->entry->file );
+    }
+  }
+  free( c );
+}
+
+
+/* open a connection for a request; latency is measured from start */
+static void begin( const struct entry *entry, double pause, double start ) {
+  struct conn *c = checked( calloc( 1, sizeof( struct conn ) ) );
+  struct epoll_event ev;
+
+  c->seq = ++started;
+  c->entry = entry;
+  c->start = start;
+  c->due = pause;                                       /* seconds for now */
+  c->reqlen = snprintf( c->req, sizeof( c->req ),
+                        "GET /%s HTTP/1.1\r\nHost: localhost\r\n"
+                        "Connection: close\r\n\r\n", entry->file );
+
+  c->fd = socket( server->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+  if( ( c->fd < 0 ) ||
+      ( ( connect( c->fd, server->ai_addr, server->ai_addrlen ) < 0 ) &&
+        ( errno != EINPROGRESS ) ) ) {
+    if( c->fd >= 0 ) {
+      close( c->fd );
+    }
+    failed++;
+    free( c );
+    return;
+  }
+  c->state = STATE_CONNECTING;
+  ev.events = EPOLLOUT;
+  ev.data.ptr = c;
+  epoll_ctl( epfd, EPOLL_CTL_ADD, c->fd, &ev );
+  active++;
+}
+
+
+/* send what is left of the request; once it is all out, wait for the
+ * response */
+static void send_request( struct conn *c ) {
+  struct epoll_event ev;
+  ssize_t n;
+
+  c->state = STATE_SENDING;
+  while( c->sent < c->reqlen ) {
+    n = send( c->fd, c->req + c->sent, c->reqlen - c->sent, MSG_NOSIGNAL );
+    if( n < 0 ) {
+      if( errno == EAGAIN ) {
+        return;                                         /* still EPOLLOUT */
+      }
+      finish( c, 0 );
+      return;
+    }
+    c->sent += n;
+  }
+  c->state = STATE_RECEIVING;
+  ev.events = EPOLLIN;
+  ev.data.ptr = c;
+  epoll_ctl( epfd, EPOLL_CTL_MOD, c->fd, &ev );
+}
+
+
+/* the connection is established: pause, or send the request right away */
+static void connected( struct conn *c, int mode ) {
+  struct epoll_event ev;
+  int err = 0;
+  socklen_t len = sizeof( err );
+
+  if( getsockopt( c->fd, SOL_SOCKET, SO_ERROR, &err, &len ) < 0 || err ) {
+    finish( c, 0 );
+    return;
+  }
+  if( c->due > 0 ) {                                    /* pause first */
+    c->state = STATE_PAUSED;
+    c->due += now();
+    ev.events = 0;
+    ev.data.ptr = c;
+    epoll_ctl( epfd, EPOLL_CTL_MOD, c->fd, &ev );
+    timer_add( c );
+    return;
+  }
+  if( mode == MODE_SCRIPT ) {
+    c->start = now();                                   /* time the request */
+  }
+  send_request( c );
+}
+
+
+/* the pause of a connection is over */
+static void resume( struct conn *c, int mode ) {
+  struct epoll_event ev;
+
+  if( mode == MODE_SCRIPT ) {
+    c->start = now();
+  }
+  c->state = STATE_SENDING;
+  ev.events = EPOLLOUT;
+  ev.data.ptr = c;
+  epoll_ctl( epfd, EPOLL_CTL_MOD, c->fd, &ev );
+  send_request( c );
+}
+
+
+/* read what has arrived, until the server closes */
+static void receive( struct conn *c ) {
+  static char buf[RECV_SIZE];
+  int have;
+  ssize_t n;
+
+  for( ;; ) {
+    n = recv( c->fd, buf, sizeof( buf ), 0 );
+    if( n > 0 ) {
+      if( c->bytes < (long long)sizeof( c->status ) - 1 ) {
+        have = sizeof( c->status ) - 1 - c->bytes;
+        memcpy( c->status + c->bytes, buf, n < have ? n : have );
+      }
+      c->bytes += n;
+    } else if( n == 0 ) {
+      finish( c, 1 );
+      return;
+    } else if( errno == EAGAIN ) {
+      return;
+    } else if( errno != EINTR ) {
+      finish( c, 0 );
+      return;
+    }
+  }
+}
+
+
+/* a random script line */
+static const struct entry *pick() {
+  return &entries[(int)( erand48( seed ) * nentries ) % nentries];
+}
+
+
+static int compare( const void *a, const void *b ) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+
+  return ( x > y ) - ( x < y );
+}
+
+
+/* the latency below which a fraction q of the requests completed, in ms */
+static double percentile( double q ) {
+  long i = (long)ceil( q * nlatencies ) - 1;
+
+  return latencies[i < 0 ? 0 : i] * 1e3;
+}
+
+
+static void report( int mode, int clients, double rate, double elapsed ) {
+  double sum = 0;
+  long i;
+
+  if( mode == MODE_CLOSED ) {
+    printf( "mode: closed loop, %d clients, %.1f s\n", clients, elapsed );
+  } else if( mode == MODE_OPEN ) {
+    printf( "mode: open loop, %.1f requests/s, %.1f s\n", rate, elapsed );
+  } else {
+    printf( "mode: script, %d requests, %.1f s\n", nentries, elapsed );
+  }
+  printf( "requests: %ld completed, %ld failed, %ld non-2xx, %ld unfinished\n",
+          nlatencies, failed, non2xx, active );
+  printf( "throughput: %.1f requests/s, %.2f MB/s\n", nlatencies / elapsed,
+          total_bytes / elapsed / 1e6 );
+  if( !nlatencies ) {
+    return;
+  }
+  qsort( latencies, nlatencies, sizeof( double ), compare );
+  for( i = 0; i < nlatencies; i++ ) {
+    sum += latencies[i];
+  }
+  printf( "latency (ms): mean %.3f p50 %.3f p99 %.3f p999 %.3f max %.3f\n",
+          sum / nlatencies * 1e3, percentile( 0.5 ), percentile( 0.99 ),
+          percentile( 0.999 ), latencies[nlatencies - 1] * 1e3 );
+}
+
+
+/* allow as many connections as the hard limit does */
+static void raise_fd_limit() {
+  struct rlimit rl;
+
+  if( getrlimit( RLIMIT_NOFILE, &rl ) == 0 && rl.rlim_cur < rl.rlim_max ) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit( RLIMIT_NOFILE, &rl );
+  }
+}
+
+
+static void usage() {
+  fprintf( stderr, "usage: ./hydra [-t] [-h HOST] [-c CLIENTS | -r RATE] "
+           "[-d SECONDS] [-n REQUESTS] [-s SEED] < test.in\n" );
+  exit( 1 );
+}
+
+
+int main( int argc, char **argv ) {
+  struct epoll_event events[MAX_EVENTS];
+  struct addrinfo hints;
+  struct conn *c;
+  char port[16];
+  const char *host = "localhost";
+  int mode = MODE_SCRIPT;
+  int clients = 0;
+  double rate = 0;
+  double duration = -1;
+  long limit = -1;                                      /* -n */
+  int next = 0;                                         /* script line */
+  double start;
+  double t;
+  double stop;                                          /* no new requests */
+  double arrival = 0;                                   /* open loop */
+  double wake;
+  int timeout;
+  int opt;
+  int n;
+  int i;
+
+  seed[0] = 0x330e;
+  while( ( opt = getopt( argc, argv, "th:c:r:d:n:s:" ) ) != -1 ) {
+    switch( opt ) {
+    case 't':
+      print_times = 1;
+      break;
+    case 'h':
+      host = optarg;
+      break;
+    case 'c':
+      mode = MODE_CLOSED;
+      clients = atoi( optarg );
+      break;
+    case 'r':
+      mode = MODE_OPEN;
+      rate = atof( optarg );
+      break;
+    case 'd':
+      duration = atof( optarg );
+      break;
+    case 'n':
+      limit = atol( optarg );
+      break;
+    case 's':
+      seed[1] = atoi( optarg );
+      seed[2] = atoi( optarg ) >> 16;
+      break;
+    default:
+      usage();
+    }
+  }
+  if( ( mode == MODE_CLOSED && clients <= 0 ) || ( mode == MODE_OPEN && rate <= 0 ) ) {
+    usage();
+  }
+  if( duration < 0 ) {
+    duration = limit < 0 ? 10 : INFINITY;
+  }
+
+  snprintf( port, sizeof( port ), "%d", read_script() );
+  memset( &hints, 0, sizeof( hints ) );
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if( ( n = getaddrinfo( host, port, &hints, &server ) ) ) {
+    fprintf( stderr, "%s: %s\n", host, gai_strerror( n ) );
+    return 1;
+  }
+  raise_fd_limit();
+  signal( SIGPIPE, SIG_IGN );
+  epfd = epoll_create1( EPOLL_CLOEXEC );
+
+  start = now();
+  stop = mode == MODE_SCRIPT ? INFINITY : start + duration;
+
+  for( ;; ) {
+    t = now();
+    if( t >= stop || started == limit ) {               /* run is over */
+      if( stop > t ) {
+        stop = t;
+      }
+      if( !active || t >= stop + GRACE ) {
+        break;
+      }
+    }
+
+    /* start what is due */
+    if( mode == MODE_SCRIPT ) {
+      while( next < nentries && entries[next].delay <= t - start ) {
+        begin( &entries[next], entries[next].pause, t );
+        next++;
+      }
+      if( next == nentries && !active ) {
+        break;
+      }
+    } else if( mode == MODE_CLOSED ) {
+      for( i = active; t < stop && i < clients && started != limit; i++ ) {
+        begin( pick(), 0, t );                          /* a client goes again */
+      }
+    } else if( mode == MODE_OPEN ) {
+      while( t < stop && started != limit && start + arrival <= t ) {
+        begin( pick(), 0, start + arrival );            /* when it was due */
+        arrival -= log( 1 - erand48( seed ) ) / rate;
+      }
+    }
+    while( timers.size && timers.heap[0]->due <= t ) {
+      c = timer_pop();
+      resume( c, mode );
+    }
+
+    /* sleep until the next event or the next thing due */
+    wake = t + 0.1;
+    if( mode == MODE_SCRIPT && next < nentries && start + entries[next].delay < wake ) {
+      wake = start + entries[next].delay;
+    } else if( mode == MODE_OPEN && start + arrival < wake ) {
+      wake = start + arrival;
+    }
+    if( timers.size && timers.heap[0]->due < wake ) {
+      wake = timers.heap[0]->due;
+    }
+    timeout = wake > t ? (int)ceil( ( wake - t ) * 1e3 ) : 0;
+
+    n = epoll_wait( epfd, events, MAX_EVENTS, timeout );
+    for( i = 0; i < n; i++ ) {
+      c = events[i].data.ptr;
+      if( c->state == STATE_CONNECTING ) {
+        connected( c, mode );
+      } else if( c->state == STATE_SENDING ) {
+        send_request( c );
+      } else if( c->state == STATE_RECEIVING ) {
+        receive( c );
+      }
+    }
+  }
+
+  fflush( stdout );
+  report( mode, clients, rate, now() - start );
+  return 0;
+}
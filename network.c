@@ -5,6 +5,7 @@
  *          Please see network.h for documentation on how to use this module.
  */
 
+#define _GNU_SOURCE                                     /* for accept4() */
 
 #include <stddef.h>
 #include <math.h>
@@ -18,7 +19,6 @@
 #include <errno.h>
 #include <unistd.h>
 #include <sys/wait.h>
-#include <sys/select.h>
 #include <poll.h>
 
 #include "network.h"
@@ -34,22 +34,22 @@ static int serv_sock = -1;
  */
 extern void network_wait() {
   int n;                                                /* result var */
-  fd_set sel;                                           /* descriptor bits */
-  fd_set err;
+  struct pollfd pfd;                                    /* descriptor to poll */
   
   if( serv_sock < 0 ) {                                 /* sanity check */
     perror( "Error, network not initalized" );
     abort();
   }
 
-  FD_ZERO( &sel );                                      /* initialize bits */
-  FD_ZERO( &err );
-  FD_SET( serv_sock, &sel );
-  FD_SET( serv_sock, &err );
+  pfd.fd = serv_sock;                                   /* initialize poll */
+  pfd.events = POLLIN;
+  pfd.revents = 0;
 
-  n = select( serv_sock + 1, &sel, NULL, &err, NULL );  /* wait for conn. */
+  do {                                                  /* wait for conn. */
+    n = poll( &pfd, 1, -1 );
+  } while( ( n < 0 ) && ( errno == EINTR ) );
 
-  if( ( n <= 0 ) || FD_ISSET( serv_sock, &err ) ) {     /* check for errors */
+  if( ( n <= 0 ) || ( pfd.revents & ( POLLERR | POLLNVAL ) ) ) { /* errors */
     perror( "Error occurred while waiting" );
     abort();
   } 
@@ -66,38 +66,40 @@ extern void network_wait() {
  *          or -1 if no client is waiting.
  */
 extern int network_open() {
-  struct sockaddr_in server;                            /* addr of client */
-  int len = sizeof( server );                           /* length of addr */
-  int n;                                                /* return var */
-  int sock = -1;                                        /* socket for client */
-  fd_set sel;                                           /* descriptor bits */
-  fd_set err;
-  struct timeval tv;                                    /* time to wait */
-  
   if( serv_sock < 0 ) {                                 /* sanity check */
     perror( "Error, network not initalized" );
     abort();
   }
+  return network_accept( serv_sock );                   /* return client conn.*/
+}
 
-  FD_ZERO( &sel );                                      /* check for client */
-  FD_ZERO( &err );
-  FD_SET( serv_sock, &sel );
-  FD_SET( serv_sock, &err );
-  memset( &tv, 0, sizeof( tv ) );
-  n = select( serv_sock + 1, &sel, NULL, &err, &tv );
 
-  if( ( n < 0 ) || FD_ISSET( serv_sock, &err ) ) {      /* check for errors */
-    perror( "Error occurred on select()" );
-    abort();
-  } else if( ( n > 0 ) && FD_ISSET( serv_sock, &sel ) ) { /* client is waiting*/
-    /* get client connection */
-    sock = accept( serv_sock, (struct sockaddr *)&server, (socklen_t *)&len );
+extern int network_cpu( int sock, int cpu ) {
+  return setsockopt( sock, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof( int ) );
+}
 
-    if( sock < 0 ) {                                    /* check for errors */
-      perror( "Error occurred on select()" );
-    }
+
+extern int network_accept( int sock ) {
+  struct sockaddr_in server;                            /* addr of client */
+  socklen_t len = sizeof( server );                     /* length of addr */
+  int client;                                           /* socket for client */
+
+  /* the server socket is non-blocking, so accept() itself tells us whether
+   * a client is waiting; no separate readiness check is needed.
+   */
+  do {
+    client = accept4( sock, (struct sockaddr *)&server, &len, SOCK_NONBLOCK | SOCK_CLOEXEC );
+  } while( ( client < 0 ) && ( errno == EINTR ) );
+
+  if( ( client < 0 ) && ( errno != EAGAIN ) && ( errno != EWOULDBLOCK ) ) {
+    perror( "Error occurred on accept()" );             /* check for errors */
   }
-  return sock;                                          /* return client conn.*/
+  return client;
+}
+
+
+extern int network_socket() {
+  return serv_sock;
 }
 
 
@@ -110,34 +112,41 @@ extern int network_open() {
  * Returns: None
  */
 extern void network_init( int port ) {
+  serv_sock = network_listen( port, NETWORK_BACKLOG, 0 );
+}
+
+
+extern int network_listen( int port, int backlog, int reuseport ) {
   struct sockaddr_in self;                             /* socket address */
   int yes = 1;                                         /* config variable */
+  int sock;                                            /* server socket */
   
-  serv_sock = socket( PF_INET, SOCK_STREAM, 0 );       /* create socket */
-  if( serv_sock < 0 ) {
+  sock = socket( PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+  if( sock < 0 ) {
     perror( "Error while creating server socket" );
     abort();
   } 
 
                                                        /* configure socket */
-  setsockopt( serv_sock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof( int ) );
-  setsockopt( serv_sock, SOL_SOCKET, SO_KEEPALIVE, &yes, sizeof( int ) );
+  setsockopt( sock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof( int ) );
+  setsockopt( sock, SOL_SOCKET, SO_KEEPALIVE, &yes, sizeof( int ) );
+  if( reuseport &&                                     /* share the port */
+      setsockopt( sock, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof( int ) ) ) {
+    perror( "Error setting SO_REUSEPORT" );
+    abort();
+  }
 
   self.sin_family = AF_INET;                           /* bind socket to port */
   self.sin_addr.s_addr = htonl( INADDR_ANY );
   self.sin_port = htons( port );
-  if( bind( serv_sock, (struct sockaddr *)&self, sizeof( self ) ) )  {
+  if( bind( sock, (struct sockaddr *)&self, sizeof( self ) ) )  {
     perror( "Error on bind()" );
     abort();
   }
 
-  if( listen( serv_sock, 64 ) ) {                      /* allow connections */
+  if( listen( sock, backlog ) ) {                      /* allow connections */
     perror( "Error on listen()" );
     abort();
   }
+  return sock;
 }
-
-
-
-
-
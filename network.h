@@ -9,12 +9,20 @@
 #define NETWORK_H
 
 #include <stdio.h>
+#include <sys/socket.h>
+
+#define NETWORK_BACKLOG SOMAXCONN  /* default listen() backlog */
 
 /* 
- * This module has three functions:
- *   network_init() : inititalizes the module
- *   network_wait() : wait until a client connects
- *   network_open() : open the next client connection
+ * This module has four functions:
+ *   network_init()   : inititalizes the module
+ *   network_wait()   : wait until a client connects
+ *   network_open()   : open the next client connection
+ *   network_socket() : the listening socket, for use with an event loop
+ *
+ * and two functions for programs that manage their own listening sockets:
+ *   network_listen() : create a listening socket
+ *   network_accept() : open the next client connection on that socket
  *
  * The network_init() function should be called once, at the start of the 
  * program.  This function will create a socket to which web clients can 
@@ -28,6 +36,16 @@
  * The network_open() function opens a waiting web client connection and
  * returns an integer file descriptor.  If no clients are waiting, this 
  * function returns -1.
+ *
+ * The listening socket is non-blocking.  Programs that watch many sockets
+ * can register network_socket() with an event loop (see event.h) instead of
+ * calling network_wait(), and call network_open() until it returns -1 each
+ * time the socket becomes readable.  Client connections are non-blocking
+ * too, so a write to a slow client returns EAGAIN rather than stalling.
+ *
+ * With network_listen() several sockets may be bound to the same port using
+ * SO_REUSEPORT.  The kernel then spreads new connections across them, so
+ * each thread can own a socket and accept its own clients.
  */
 
 
@@ -63,4 +81,45 @@ extern void network_wait();
  */
 extern int network_open();
 
+
+/* This function returns the listening socket created by network_init().
+ * Parameters: None
+ * Returns: The server socket file descriptor, or -1 if not initialized
+ */
+extern int network_socket();
+
+
+/* This function creates a non-blocking server socket bound to a specified
+ *   port.  This function will abort the program if an error occurs.
+ * Parameters:
+ *             port      : the port on which the server should listen
+ *             backlog   : the length of the pending connection queue
+ *             reuseport : if non-zero, set SO_REUSEPORT so that other
+ *                         sockets may listen on the same port
+ * Returns: The server socket file descriptor
+ */
+extern int network_listen( int port, int backlog, int reuseport );
+
+
+/* This function ties a server socket that shares its port (SO_REUSEPORT)
+ *    to a CPU with SO_INCOMING_CPU: the kernel then hands it the connections
+ *    whose packets are processed on that CPU, so a connection stays on the
+ *    core that takes its interrupts.
+ * Parameters:
+ *             sock : the server socket
+ *             cpu  : the CPU that serves the connections of sock
+ * Returns: 0 on success, -1 if the kernel does not support it
+ */
+extern int network_cpu( int sock, int cpu );
+
+
+/* This function opens the next waiting client connection on a server socket
+ *    created by network_listen().
+ * Parameters:
+ *             sock : the server socket
+ * Returns: A positive integer file decriptor to the next clients connection,
+ *          which is non-blocking, or -1 if no client is waiting.
+ */
+extern int network_accept( int sock );
+
 #endif
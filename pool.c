@@ -0,0 +1,117 @@
+/*
+ * File: pool.c
+ * Purpose: This file contains the pool module, which hands out fixed size
+ *          objects from per-thread slabs.  Please see pool.h for
+ *          documentation on how to use this module.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+
+#include "pool.h"
+
+struct cache;
+
+/* precedes every object */
+struct object {
+  struct cache *owner;                   /* thread list it returns to */
+  struct object *next;                   /* free list link */
+} __attribute__(( aligned( alignof( max_align_t ) ) ));
+
+/* one thread's free objects of one pool */
+struct cache {
+  struct object *free;                   /* only the owner touches this */
+  _Atomic( struct object * ) remote;     /* freed by other threads */
+  int id;                                /* pool the list belongs to */
+};
+
+static __thread struct cache *caches[POOL_MAX];
+static atomic_int next_id;
+
+
+/* the calling thread's list for a pool */
+static struct cache *thread_cache( struct pool *pool ) {
+  struct cache *c = caches[pool->id];
+
+  if( !c ) {                                            /* 1st use by thread */
+    c = calloc( 1, sizeof( struct cache ) );
+    if( !c ) {                                          /* error check */
+      perror( "Error while allocating memory" );
+      abort();
+    }
+    c->id = pool->id;
+    caches[pool->id] = c;
+  }
+  return c;
+}
+
+
+/* fill an empty list with a new slab of objects */
+static void carve( struct pool *pool, struct cache *c ) {
+  char *slab = malloc( pool->size * pool->per_slab );
+  struct object *o;
+  int i;
+
+  if( !slab ) {                                         /* error check */
+    perror( "Error while allocating memory" );
+    abort();
+  }
+  for( i = pool->per_slab - 1; i >= 0; i-- ) {
+    o = (struct object *)( slab + i * pool->size );
+    o->owner = c;
+    o->next = c->free;
+    c->free = o;
+  }
+}
+
+
+extern void pool_init( struct pool *pool, size_t size, int per_slab ) {
+  size_t align = alignof( struct object );
+
+  pool->size = sizeof( struct object ) + ( size + align - 1 ) / align * align;
+  pool->per_slab = per_slab > 0 ? per_slab : POOL_SLAB;
+  pool->id = atomic_fetch_add( &next_id, 1 );
+  if( pool->id >= POOL_MAX ) {
+    fprintf( stderr, "Too many object pools\n" );
+    abort();
+  }
+}
+
+
+extern void *pool_alloc( struct pool *pool ) {
+  struct cache *c = thread_cache( pool );
+  struct object *o;
+
+  if( !c->free ) {                                      /* take back remote */
+    c->free = atomic_exchange( &c->remote, NULL );
+  }
+  if( !c->free ) {
+    carve( pool, c );
+  }
+  o = c->free;
+  c->free = o->next;
+  return o + 1;
+}
+
+
+extern void pool_free( void *obj ) {
+  struct object *o;
+  struct cache *c;
+
+  if( !obj ) {
+    return;
+  }
+  o = (struct object *)obj - 1;
+  c = o->owner;
+
+  if( caches[c->id] == c ) {                            /* our own object */
+    o->next = c->free;
+    c->free = o;
+    return;
+  }
+
+  o->next = atomic_load( &c->remote );                  /* push on owner's */
+  while( !atomic_compare_exchange_weak( &c->remote, &o->next, o ) );
+}
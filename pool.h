@@ -0,0 +1,68 @@
+/*
+ * File: pool.h
+ * Purpose: This file contains the prototypes and describes how to use the
+ *          pool module, which hands out fixed size objects from per-thread
+ *          slabs instead of malloc().
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+#define POOL_MAX 8                         /* pools in one program */
+#define POOL_SLAB 64                       /* default objects per slab */
+
+/*
+ * This module recycles objects of one size:
+ *   pool_init()  : initializes a pool
+ *   pool_alloc() : take an object from the calling thread's free list
+ *   pool_free()  : give an object back to the thread that allocated it
+ *
+ * Every thread has its own free list for each pool, so allocating takes no
+ * lock.  When a thread's list is empty it carves a new slab of objects with
+ * one malloc(); slabs are never returned, so once a program reaches its
+ * peak number of live objects it stops calling malloc() altogether.
+ *
+ * An object may be freed by any thread.  A thread freeing an object it did
+ * not allocate pushes it on the owner's remote list with a single
+ * compare-and-swap; the owner takes the whole remote list back before it
+ * carves a new slab.  Objects thus stay in the memory of the thread that
+ * first touched them.
+ */
+
+struct pool {
+  size_t size;                           /* bytes per object, with header */
+  int per_slab;                          /* objects carved at a time */
+  int id;                                /* index of the per-thread lists */
+};
+
+
+/* This function initializes a pool.  This function will abort the program
+ *   if more than POOL_MAX pools are created.
+ * Parameters:
+ *             pool     : the pool
+ *             size     : the size of each object
+ *             per_slab : the number of objects allocated at a time
+ * Returns: None
+ */
+extern void pool_init( struct pool *pool, size_t size, int per_slab );
+
+
+/* This function takes an object from the pool.  This function will abort
+ *    the program if memory runs out.
+ * Parameters:
+ *             pool : the pool
+ * Returns: A pointer to an uninitialized object, aligned for any type
+ */
+extern void *pool_alloc( struct pool *pool );
+
+
+/* This function returns an object to the pool it came from.
+ * Parameters:
+ *             obj : an object returned by pool_alloc(), or NULL
+ * Returns: None
+ */
+extern void pool_free( void *obj );
+
+#endif
@@ -0,0 +1,699 @@
+/*
+ * File: queuebench.c
+ * Purpose: This file contains microbenchmarks of the scheduler's data
+ *          structures: the list operations, the SJF/SRPT heap, the
+ *          work-stealing deque, the inject queue and the MLFB fifos, each
+ *          at queue sizes from 10 to 1M, and a full SRPT and MLFB
+ *          scheduling decision.  The queues the workers share are also run
+ *          with 1 to 8 threads contending for them.
+ *
+ *          Every case prints one line with the time per operation and,
+ *          where the kernel lets us count them, last level cache misses per
+ *          operation ("-" otherwise).  The columns are separated by blanks
+ *          so runs can be diffed or loaded into a spreadsheet.  Random
+ *          numbers come from a fixed seed, so every run does the same work.
+ *
+ *          usage: ./queuebench [OPS]
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "datastruct.h"
+
+#define OPS 1000000                        /* default constant time ops per case */
+#define WORK 100000000                     /* nodes visited by a linear case */
+#define BATCH 1024                         /* ops timed between undo steps */
+#define NEEDLES 64                         /* clients find() looks for */
+#define MIN_SIZE 10
+#define MAX_SIZE 1000000
+#define MAX_LINKED 10000                   /* clients linked in place (8KB each) */
+#define MAX_SORT 10000                     /* sort() is quadratic */
+#define DEPTH 1024                         /* queue size of contended cases */
+#define MAX_THREADS 8
+#define LEVELS 3                           /* MLFB levels */
+#define SLICE 65536                        /* SRPT slice */
+#define MAX_REM 10000000                   /* largest file */
+
+/* time and cache misses of the timed parts of one case */
+struct meter {
+  int fd;                                  /* perf event, -1 if none */
+  double ns;
+  long long misses;
+  double t0;
+  long long m0;
+};
+
+/* one thread of a contended case */
+struct runner {
+  pthread_t thread;
+  void ( *run )( struct runner * );
+  long ops;
+  struct meter meter;
+  unsigned int seed;
+  struct client *requeue;                  /* SRPT: client to put back */
+  double begin;                            /* when it started running */
+  double end;
+};
+
+static struct client *clients;             /* zeroed, only a few fields used */
+static int nclients;
+static struct client needles[NEEDLES];     /* at the end of the list */
+static unsigned int seed = 1;
+static long ops = OPS;
+
+static pthread_barrier_t barrier;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct heap shared_heap;
+static struct injectq shared_inject;
+static struct fifo shared_levels[LEVELS];
+static struct fifo *shared_fifo = &shared_levels[0];
+
+
+/* nanoseconds on the monotonic clock */
+static double now() {
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static long long read_counter( int fd ) {
+  long long count = 0;
+
+  if( ( fd >= 0 ) && ( read( fd, &count, sizeof( count ) ) != sizeof( count ) ) ) {
+    count = 0;
+  }
+  return count;
+}
+
+
+/* start counting the calling thread's cache misses, if perf events are
+ * available */
+static void meter_open( struct meter *m ) {
+  struct perf_event_attr attr;
+
+  memset( &attr, 0, sizeof( attr ) );
+  attr.size = sizeof( attr );
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = PERF_COUNT_HW_CACHE_MISSES;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  m->fd = syscall( SYS_perf_event_open, &attr, 0, -1, -1, 0 );
+  m->ns = 0;
+  m->misses = 0;
+}
+
+
+static void meter_close( struct meter *m ) {
+  if( m->fd >= 0 ) {
+    close( m->fd );
+  }
+}
+
+
+static void meter_start( struct meter *m ) {
+  m->m0 = read_counter( m->fd );
+  m->t0 = now();
+}
+
+
+static void meter_stop( struct meter *m ) {
+  m->ns += now() - m->t0;
+  m->misses += read_counter( m->fd ) - m->m0;
+}
+
+
+static void report( const char *name, int size, int threads, long n,
+                    double ns, long long misses, int counted ) {
+  char perop[32] = "-";
+
+  if( counted ) {
+    snprintf( perop, sizeof( perop ), "%.3f", (double)misses / n );
+  }
+  printf( "%-16s %8d %7d %10ld %12.1f %12s\n", name, size, threads, n,
+          ns / n, perop );
+  fflush( stdout );
+}
+
+
+/* print a single threaded case and reset its meter */
+static void done( const char *name, int size, long n, struct meter *m ) {
+  report( name, size, 1, n, m->ns, m->misses, m->fd >= 0 );
+  m->ns = 0;
+  m->misses = 0;
+}
+
+
+/* the i-th client; clients are reused when the queue is larger */
+static struct client *client( long i ) {
+  return &clients[i % nclients];
+}
+
+
+/* a random file size */
+static int random_rem( unsigned int *s ) {
+  return rand_r( s ) % MAX_REM + 1;
+}
+
+
+/* operations done by a constant time case, a multiple of BATCH */
+static long constant_ops() {
+  return ( ops + BATCH - 1 ) / BATCH * BATCH;
+}
+
+
+/* operations done by a case that visits size elements */
+static long linear_ops( long size ) {
+  long n = WORK / size;
+
+  return n < 16 ? 16 : n;
+}
+
+
+static void bench_list( int size, struct meter *m ) {
+  struct linkedlist list;
+  int k = size < NEEDLES ? size : NEEDLES;
+  long n;
+  long i;
+  int j;
+
+  initList( &list );
+  for( i = 0; i < size - k; i++ ) {
+    insertLast( &list, client( i ) );
+  }
+  for( j = 0; j < k; j++ ) {
+    insertLast( &list, &needles[j] );                   /* near worst case */
+  }
+
+  n = linear_ops( size ) / k * k + k;
+  meter_start( m );
+  for( i = 0; i < n; i++ ) {
+    find( &list, &needles[i % k] );
+  }
+  meter_stop( m );
+  done( "list_find", size, n, m );
+
+  for( i = 0; i < n; i += k ) {
+    meter_start( m );
+    for( j = 0; j < k; j++ ) {
+      delete( &list, &needles[j] );
+    }
+    meter_stop( m );
+    for( j = 0; j < k; j++ ) {
+      insertLast( &list, &needles[j] );
+    }
+  }
+  done( "list_delete", size, n, m );
+
+  n = constant_ops();
+  for( i = 0; i < n; i += BATCH ) {
+    meter_start( m );
+    for( j = 0; j < BATCH; j++ ) {
+      insertFirst( &list, client( j ) );
+    }
+    meter_stop( m );
+    for( j = 0; j < BATCH; j++ ) {
+      deleteFirst( &list );
+    }
+  }
+  done( "list_insertFirst", size, n, m );
+
+  for( i = 0; i < n; i += BATCH ) {
+    meter_start( m );
+    for( j = 0; j < BATCH; j++ ) {
+      insertLast( &list, client( j ) );
+    }
+    meter_stop( m );
+    for( j = 0; j < BATCH; j++ ) {
+      deleteFirst( &list );
+    }
+  }
+  done( "list_insertLast", size, n, m );
+
+  for( i = 0; i < n; i += BATCH ) {
+    for( j = 0; j < BATCH; j++ ) {
+      insertLast( &list, client( j ) );
+    }
+    meter_start( m );
+    for( j = 0; j < BATCH; j++ ) {
+      deleteFirst( &list );
+    }
+    meter_stop( m );
+  }
+  done( "list_deleteFirst", size, n, m );
+
+  meter_start( m );
+  for( i = 0; i < n; i++ ) {
+    rotate( &list );
+  }
+  meter_stop( m );
+  done( "list_rotate", size, n, m );
+
+  while( length( &list ) > 1 ) {
+    deleteFirst( &list );
+  }
+  deleteFirst( &list );
+
+  if( size > MAX_SORT ) {
+    return;
+  }
+  initList( &list );
+  for( i = 0; i < size; i++ ) {
+    insertLast( &list, client( i ) );
+  }
+  n = WORK / ( (long)size * size / 2 );
+  n = n < 4 ? 4 : n;
+  for( i = 0; i < n; i++ ) {
+    for( j = 0; j < size; j++ ) {
+      client( j )->rem = random_rem( &seed );           /* unsorted again */
+    }
+    meter_start( m );
+    sort( &list );
+    meter_stop( m );
+  }
+  done( "list_sort", size, n, m );
+  while( length( &list ) > 1 ) {
+    deleteFirst( &list );
+  }
+  deleteFirst( &list );
+}
+
+
+static void bench_heap( int size, struct meter *m ) {
+  struct heap heap;
+  struct client *c = NULL;
+  long n = constant_ops();
+  long i;
+  int j;
+
+  initHeap( &heap );
+  for( i = 0; i < size; i++ ) {
+    client( i )->rem = random_rem( &seed );
+    heapInsert( &heap, client( i ) );
+  }
+
+  for( i = 0; i < n; i += BATCH ) {
+    meter_start( m );
+    for( j = 0; j < BATCH; j++ ) {
+      heapInsert( &heap, client( j ) );
+    }
+    meter_stop( m );
+    for( j = 0; j < BATCH; j++ ) {
+      heapPop( &heap );
+    }
+  }
+  done( "heap_insert", size, n, m );
+
+  for( i = 0; i < n; i += BATCH ) {
+    for( j = 0; j < BATCH; j++ ) {
+      heapInsert( &heap, client( j ) );
+    }
+    meter_start( m );
+    for( j = 0; j < BATCH; j++ ) {
+      heapPop( &heap );
+    }
+    meter_stop( m );
+  }
+  done( "heap_pop", size, n, m );
+
+  /* an SRPT decision: put the last client back keyed by what it has left,
+   * then take the one with the least left */
+  meter_start( m );
+  for( i = 0; i < n; i++ ) {
+    pthread_mutex_lock( &lock );
+    if( c ) {
+      heapInsert( &heap, c );
+    }
+    c = heapPop( &heap );
+    pthread_mutex_unlock( &lock );
+    c->rem = c->rem > SLICE ? c->rem - SLICE : random_rem( &seed );
+  }
+  meter_stop( m );
+  done( "srpt_decision", size, n, m );
+
+  free( heap.entries );
+}
+
+
+static void bench_deque( int size, struct meter *m ) {
+  struct deque dq;
+  long n = constant_ops();
+  long i;
+  int j;
+
+  initDeque( &dq );
+  for( i = 0; i < size; i++ ) {
+    dequePush( &dq, client( i ) );
+  }
+
+  for( i = 0; i < n; i += BATCH ) {
+    meter_start( m );
+    for( j = 0; j < BATCH; j++ ) {
+      dequePush( &dq, client( j ) );
+    }
+    meter_stop( m );
+    for( j = 0; j < BATCH; j++ ) {
+      dequeTake( &dq );
+    }
+  }
+  done( "deque_push", size, n, m );
+
+  for( i = 0; i < n; i += BATCH ) {
+    for( j = 0; j < BATCH; j++ ) {
+      dequePush( &dq, client( j ) );
+    }
+    meter_start( m );
+    for( j = 0; j < BATCH; j++ ) {
+      dequeTake( &dq );
+    }
+    meter_stop( m );
+  }
+  done( "deque_take", size, n, m );
+
+  for( i = 0; i < n; i += BATCH ) {
+    for( j = 0; j < BATCH; j++ ) {
+      dequePush( &dq, client( j ) );
+    }
+    meter_start( m );
+    for( j = 0; j < BATCH; j++ ) {
+      dequeSteal( &dq );
+    }
+    meter_stop( m );
+  }
+  done( "deque_steal", size, n, m );
+  /* the deque's arrays are not freed, as in the server */
+}
+
+
+static void bench_inject( int size, struct meter *m ) {
+  struct injectq q;
+  unsigned long cap = 1;
+  long n = constant_ops();
+  long i;
+  int j;
+
+  while( cap < (unsigned long)size + BATCH ) {
+    cap *= 2;
+  }
+  initInject( &q, cap );
+  for( i = 0; i < size; i++ ) {
+    injectPush( &q, client( i ) );
+  }
+
+  for( i = 0; i < n; i += BATCH ) {
+    meter_start( m );
+    for( j = 0; j < BATCH; j++ ) {
+      injectPush( &q, client( j ) );
+    }
+    meter_stop( m );
+    for( j = 0; j < BATCH; j++ ) {
+      injectPop( &q );
+    }
+  }
+  done( "inject_push", size, n, m );
+
+  for( i = 0; i < n; i += BATCH ) {
+    for( j = 0; j < BATCH; j++ ) {
+      injectPush( &q, client( j ) );
+    }
+    meter_start( m );
+    for( j = 0; j < BATCH; j++ ) {
+      injectPop( &q );
+    }
+    meter_stop( m );
+  }
+  done( "inject_pop", size, n, m );
+  free( q.cells );
+}
+
+
+/* take the client at the highest non-empty level, and put it back a level
+ * lower, or at level 0 (its next request) if it was at the bottom */
+static void mlfb_decision( struct fifo *levels, long long t ) {
+  struct client *c = NULL;
+  int level;
+
+  for( level = 0; !c && level < LEVELS; level++ ) {
+    c = fifoPop( &levels[level] );
+  }
+  if( c ) {
+    c->level = c->level < LEVELS - 1 ? c->level + 1 : 0;
+    fifoPush( &levels[c->level], c, t );
+  }
+}
+
+
+/* fifos link the clients themselves, so every client queued is distinct:
+ * size of them are queued and BATCH more are kept in spare */
+static void bench_fifo( int size, struct meter *m ) {
+  struct fifo levels[LEVELS];
+  struct fifo *q = &levels[0];
+  struct client *spare[BATCH];
+  long n = constant_ops();
+  long i;
+  int j;
+
+  if( size > MAX_LINKED ) {
+    return;
+  }
+  for( i = 0; i < LEVELS; i++ ) {
+    initFifo( &levels[i] );
+  }
+  for( j = 0; j < BATCH; j++ ) {
+    spare[j] = client( j );
+  }
+  for( i = 0; i < size; i++ ) {
+    fifoPush( q, client( BATCH + i ), 0 );
+  }
+
+  for( i = 0; i < n; i += BATCH ) {
+    meter_start( m );
+    for( j = 0; j < BATCH; j++ ) {
+      fifoPush( q, spare[j], i );
+    }
+    meter_stop( m );
+    for( j = 0; j < BATCH; j++ ) {
+      spare[j] = fifoPop( q );
+    }
+  }
+  done( "fifo_push", size, n, m );
+
+  for( i = 0; i < n; i += BATCH ) {
+    for( j = 0; j < BATCH; j++ ) {
+      fifoPush( q, spare[j], i );
+    }
+    meter_start( m );
+    for( j = 0; j < BATCH; j++ ) {
+      spare[j] = fifoPop( q );
+    }
+    meter_stop( m );
+  }
+  done( "fifo_pop", size, n, m );
+
+  initFifo( q );
+  for( i = 0; i < size; i++ ) {
+    client( i )->level = i % LEVELS;
+    fifoPush( &levels[i % LEVELS], client( i ), 0 );
+  }
+  meter_start( m );
+  for( i = 0; i < n; i++ ) {
+    mlfb_decision( levels, i );
+  }
+  meter_stop( m );
+  done( "mlfb_decision", size, n, m );
+}
+
+
+static void run_inject( struct runner *r ) {
+  struct client *c;
+  long i;
+
+  for( i = 0; i < r->ops; i++ ) {
+    if( ( c = injectPop( &shared_inject ) ) != NULL ) {
+      injectPush( &shared_inject, c );
+    }
+  }
+}
+
+
+static void run_fifo( struct runner *r ) {
+  struct client *c;
+  long i;
+
+  for( i = 0; i < r->ops; i++ ) {
+    if( ( c = fifoPop( shared_fifo ) ) != NULL ) {
+      fifoPush( shared_fifo, c, i );
+    }
+  }
+}
+
+
+static void run_srpt( struct runner *r ) {
+  struct client *c = r->requeue;
+  long i;
+
+  for( i = 0; i < r->ops; i++ ) {
+    pthread_mutex_lock( &lock );
+    if( c ) {
+      heapInsert( &shared_heap, c );
+    }
+    c = heapPop( &shared_heap );
+    pthread_mutex_unlock( &lock );
+    if( c ) {                                           /* only we hold it */
+      c->rem = c->rem > SLICE ? c->rem - SLICE : random_rem( &r->seed );
+    }
+  }
+  r->requeue = c;
+}
+
+
+static void run_mlfb( struct runner *r ) {
+  long i;
+
+  for( i = 0; i < r->ops; i++ ) {
+    mlfb_decision( shared_levels, i );
+  }
+}
+
+
+static void *runner( void *arg ) {
+  struct runner *r = arg;
+
+  meter_open( &r->meter );
+  pthread_barrier_wait( &barrier );
+  meter_start( &r->meter );
+  r->begin = r->meter.t0;
+  r->run( r );
+  meter_stop( &r->meter );
+  r->end = now();
+  meter_close( &r->meter );
+  return NULL;
+}
+
+
+/* run a contended case on a queue holding DEPTH clients: ns/op is the wall
+ * time from the first thread starting to the last one finishing over the
+ * operations of all threads */
+static void contend( const char *name, void ( *run )( struct runner * ),
+                     int threads ) {
+  struct runner runners[MAX_THREADS];
+  long long misses = 0;
+  int counted = 1;
+  long n = constant_ops();
+  double begin = 0;
+  double end = 0;
+  int i;
+
+  pthread_barrier_init( &barrier, NULL, threads + 1 );
+  for( i = 0; i < threads; i++ ) {
+    runners[i].run = run;
+    runners[i].ops = n / threads;
+    runners[i].seed = i + 1;
+    runners[i].requeue = NULL;
+    pthread_create( &runners[i].thread, NULL, runner, &runners[i] );
+  }
+  pthread_barrier_wait( &barrier );
+  for( i = 0; i < threads; i++ ) {
+    pthread_join( runners[i].thread, NULL );
+  }
+  for( i = 0; i < threads; i++ ) {
+    if( !i || runners[i].begin < begin ) {
+      begin = runners[i].begin;
+    }
+    if( runners[i].end > end ) {
+      end = runners[i].end;
+    }
+    misses += runners[i].meter.misses;
+    counted = counted && ( runners[i].meter.fd >= 0 );
+    if( runners[i].requeue ) {                          /* back for the next case */
+      heapInsert( &shared_heap, runners[i].requeue );
+    }
+  }
+  pthread_barrier_destroy( &barrier );
+  n = n / threads * threads;
+  report( name, DEPTH, threads, n, end - begin, misses, counted );
+}
+
+
+static void bench_contended() {
+  int threads;
+  int i;
+
+  initInject( &shared_inject, DEPTH * 2 );
+  initHeap( &shared_heap );
+  for( i = 0; i < LEVELS; i++ ) {
+    initFifo( &shared_levels[i] );
+  }
+
+  for( i = 0; i < DEPTH; i++ ) {
+    injectPush( &shared_inject, client( i ) );
+  }
+  for( threads = 1; threads <= MAX_THREADS; threads *= 2 ) {
+    contend( "inject_mpmc", run_inject, threads );
+  }
+
+  for( i = 0; i < DEPTH; i++ ) {
+    fifoPush( shared_fifo, client( i ), 0 );
+  }
+  for( threads = 1; threads <= MAX_THREADS; threads *= 2 ) {
+    contend( "fifo_mpmc", run_fifo, threads );
+  }
+
+  initFifo( shared_fifo );
+  for( i = 0; i < DEPTH; i++ ) {
+    client( i )->rem = random_rem( &seed );
+    heapInsert( &shared_heap, client( i ) );
+  }
+  for( threads = 1; threads <= MAX_THREADS; threads *= 2 ) {
+    contend( "srpt_mpmc", run_srpt, threads );
+  }
+
+  for( i = 0; i < DEPTH; i++ ) {
+    client( i )->level = i % LEVELS;
+    fifoPush( &shared_levels[i % LEVELS], client( i ), 0 );
+  }
+  for( threads = 1; threads <= MAX_THREADS; threads *= 2 ) {
+    contend( "mlfb_mpmc", run_mlfb, threads );
+  }
+}
+
+
+int main( int argc, char **argv ) {
+  struct meter m;
+  int size;
+
+  if( argc > 1 ) {
+    ops = strtol( argv[1], NULL, 10 );
+  }
+
+  nclients = MAX_LINKED + BATCH;
+  clients = calloc( nclients, sizeof( struct client ) );
+  if( !clients ) {
+    perror( "Error while allocating memory" );
+    return 1;
+  }
+
+  meter_open( &m );
+  printf( "%-16s %8s %7s %10s %12s %12s\n", "bench", "size", "threads",
+          "ops", "ns/op", "misses/op" );
+  for( size = MIN_SIZE; size <= MAX_SIZE; size *= 10 ) {
+    bench_list( size, &m );
+    bench_heap( size, &m );
+    bench_deque( size, &m );
+    bench_inject( size, &m );
+    bench_fifo( size, &m );
+  }
+  meter_close( &m );
+  bench_contended();
+  return 0;
+}
@@ -0,0 +1,260 @@
+/*
+ * File: stats.c
+ * Purpose: This file contains the stats module, which keeps per-thread
+ *          latency histograms of request stages.  Please see stats.h for
+ *          documentation on how to use this module.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "stats.h"
+
+#define SUB_BITS 3                         /* buckets per power of two: 8 */
+#define SUB ( 1 << SUB_BITS )
+#define MAX_EXP 40                         /* longest time, 2^40 ns (18 min) */
+#define BUCKETS ( ( MAX_EXP - SUB_BITS + 2 ) * SUB )
+
+/* the reader adds up counters while their owner writes them; relaxed
+ * loads and stores make that well defined and compile to plain moves */
+#define BUMP( c, v ) atomic_store_explicit( &( c ), \
+          atomic_load_explicit( &( c ), memory_order_relaxed ) + ( v ), \
+          memory_order_relaxed )
+#define PEEK( c ) atomic_load_explicit( &( c ), memory_order_relaxed )
+
+struct histogram {
+  _Atomic unsigned long count;
+  _Atomic unsigned long sum;               /* ns */
+  _Atomic unsigned long max;
+  _Atomic unsigned int buckets[BUCKETS];
+};
+
+/* one thread's histograms */
+struct recorder {
+  struct histogram hist[STATS_STAGES][STATS_LEVELS][STATS_SIZES];
+  struct recorder *next;                   /* all recorders */
+};
+
+/* a merged histogram */
+struct summary {
+  unsigned long count;
+  unsigned long sum;
+  unsigned long max;
+  unsigned long buckets[BUCKETS];
+};
+
+static const char *stage_names[STATS_STAGES] = { "admit", "wait", "send", "total" };
+static const char *size_names[STATS_SIZES] = { "1K", "16K", "256K", "4M", "big" };
+
+static __thread struct recorder *mine;
+static struct recorder *recorders;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+extern long long stats_now() {
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+/* bucket of a time: values below SUB have their own bucket, larger ones
+ * share one with the values that agree in their top SUB_BITS + 1 bits */
+static int bucket( unsigned long ns ) {
+  int exp;
+
+  if( ns < SUB ) {
+    return ns;
+  }
+  exp = 63 - __builtin_clzl( ns );
+  if( exp > MAX_EXP ) {
+    return BUCKETS - 1;
+  }
+  return ( exp - SUB_BITS + 1 ) * SUB + ( ( ns >> ( exp - SUB_BITS ) ) & ( SUB - 1 ) );
+}
+
+
+/* middle of the times that fall in bucket b */
+static double bucket_value( int b ) {
+  int exp = b / SUB + SUB_BITS - 1;
+  double low;
+
+  if( b < SUB ) {
+    return b;
+  }
+  low = (double)( SUB + b % SUB ) * ( 1UL << ( exp - SUB_BITS ) );
+  return low + ( 1UL << ( exp - SUB_BITS ) ) / 2.0;
+}
+
+
+static int size_class( long long size ) {
+  int c = 0;
+
+  for( size = ( size - 1 ) >> 10; size > 0 && c < STATS_SIZES - 1; size >>= 4 ) {
+    c++;
+  }
+  return c;
+}
+
+
+static void add( struct histogram *h, long long ns ) {
+  unsigned long v = ns > 0 ? ns : 0;
+
+  BUMP( h->count, 1 );
+  BUMP( h->sum, v );
+  if( v > PEEK( h->max ) ) {
+    atomic_store_explicit( &h->max, v, memory_order_relaxed );
+  }
+  BUMP( h->buckets[bucket( v )], 1 );
+}
+
+
+extern void stats_record( int level, long long size, long long arrived,
+                          long long admitted, long long started,
+                          long long done ) {
+  struct histogram ( *hist )[STATS_LEVELS][STATS_SIZES];
+  int c = size_class( size );
+
+  if( !mine ) {                                         /* 1st use by thread */
+    mine = calloc( 1, sizeof( struct recorder ) );
+    if( !mine ) {                                       /* error check */
+      perror( "Error while allocating memory" );
+      abort();
+    }
+    pthread_mutex_lock( &lock );
+    mine->next = recorders;
+    recorders = mine;
+    pthread_mutex_unlock( &lock );
+  }
+  if( level >= STATS_LEVELS ) {
+    level = STATS_LEVELS - 1;
+  }
+
+  hist = mine->hist;
+  add( &hist[0][level][c], admitted - arrived );
+  add( &hist[1][level][c], started - admitted );
+  add( &hist[2][level][c], done - started );
+  add( &hist[3][level][c], done - arrived );
+}
+
+
+/* add up one histogram of every thread */
+static void merge( int stage, int level, int c, struct summary *s ) {
+  struct recorder *r;
+  struct histogram *h;
+  unsigned long max;
+  int b;
+
+  memset( s, 0, sizeof( *s ) );
+  for( r = recorders; r; r = r->next ) {
+    h = &r->hist[stage][level][c];
+    if( !PEEK( h->count ) ) {
+      continue;
+    }
+    s->count += PEEK( h->count );
+    s->sum += PEEK( h->sum );
+    max = PEEK( h->max );
+    s->max = max > s->max ? max : s->max;
+    for( b = 0; b < BUCKETS; b++ ) {
+      s->buckets[b] += PEEK( h->buckets[b] );
+    }
+  }
+}
+
+
+/* the time below which a fraction q of the merged requests took, in us */
+static double percentile( struct summary *s, double q ) {
+  unsigned long total = 0;
+  unsigned long want = q * s->count;
+  int b;
+
+  for( b = 0; b < BUCKETS; b++ ) {
+    total += s->buckets[b];
+    if( total > want ) {
+      break;
+    }
+  }
+  if( b == BUCKETS ) {
+    b--;
+  }
+  return ( bucket_value( b ) < s->max ? bucket_value( b ) : s->max ) / 1e3;
+}
+
+
+/* append to buf, never past its end */
+static void append( char *buf, int size, int *len, const char *fmt, ... ) {
+  va_list ap;
+  int n;
+
+  if( *len >= size - 1 ) {
+    return;
+  }
+  va_start( ap, fmt );
+  n = vsnprintf( buf + *len, size - *len, fmt, ap );
+  va_end( ap );
+  *len = n < size - *len ? *len + n : size - 1;
+}
+
+
+extern int stats_format( char *buf, int size, int json ) {
+  struct summary *s = malloc( sizeof( struct summary ) );
+  const char *sep = "";
+  int len = 0;
+  int stage;
+  int level;
+  int c;
+
+  if( !s ) {                                            /* error check */
+    perror( "Error while allocating memory" );
+    abort();
+  }
+  buf[0] = '\0';
+  if( json ) {
+    append( buf, size, &len, "[" );
+  } else {
+    append( buf, size, &len, "%-6s %5s %5s %10s %10s %10s %10s %10s %10s %10s\n",
+            "stage", "level", "size", "count", "mean_us", "p50_us", "p90_us",
+            "p99_us", "p999_us", "max_us" );
+  }
+
+  pthread_mutex_lock( &lock );                          /* recorders stable */
+  for( stage = 0; stage < STATS_STAGES; stage++ ) {
+    for( level = 0; level < STATS_LEVELS; level++ ) {
+      for( c = 0; c < STATS_SIZES; c++ ) {
+        merge( stage, level, c, s );
+        if( !s->count ) {
+          continue;
+        }
+        if( json ) {
+          append( buf, size, &len, "%s\n{\"stage\":\"%s\",\"level\":%d,\"size\":\"%s\","
+                  "\"count\":%lu,\"mean_us\":%.1f,\"p50_us\":%.1f,\"p90_us\":%.1f,"
+                  "\"p99_us\":%.1f,\"p999_us\":%.1f,\"max_us\":%.1f}", sep,
+                  stage_names[stage], level, size_names[c], s->count,
+                  s->sum / 1e3 / s->count, percentile( s, 0.5 ),
+                  percentile( s, 0.9 ), percentile( s, 0.99 ),
+                  percentile( s, 0.999 ), s->max / 1e3 );
+          sep = ",";
+        } else {
+          append( buf, size, &len, "%-6s %5d %5s %10lu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+                  stage_names[stage], level, size_names[c], s->count,
+                  s->sum / 1e3 / s->count, percentile( s, 0.5 ),
+                  percentile( s, 0.9 ), percentile( s, 0.99 ),
+                  percentile( s, 0.999 ), s->max / 1e3 );
+        }
+      }
+    }
+  }
+  pthread_mutex_unlock( &lock );
+
+  if( json ) {
+    append( buf, size, &len, "]" );
+  }
+  free( s );
+  return len;
+}
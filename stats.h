@@ -0,0 +1,73 @@
+/*
+ * File: stats.h
+ * Purpose: This file contains the prototypes and describes how to use the
+ *          stats module, which keeps latency histograms of the stages each
+ *          request goes through.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#define STATS_LEVELS 8                     /* scheduler levels told apart */
+#define STATS_SIZES 5                      /* response size classes */
+#define STATS_STAGES 4                     /* see below */
+
+/*
+ * This module records how long requests spend in each stage:
+ *   stats_now()    : the time, for stamping a request
+ *   stats_record() : record the stages of a completed request
+ *   stats_format() : merge the histograms and print them
+ *
+ * A request is stamped when it arrives (its connection is accepted, or a
+ * kept-alive connection has the next request ready), when it is admitted
+ * to the scheduler, when its first slice is sent and when it completes.
+ * The stages are the time between these: admit (arrival to admission),
+ * wait (admission to first byte), send (first byte to completion) and
+ * total.  Each stage is kept separately for every scheduler level (the
+ * level the request completed at, 0 for schedulers without levels) and
+ * response size class: up to 1KB, 16KB, 256KB, 4MB and larger.
+ *
+ * The histograms are log-linear, like HDR histograms: every power of two
+ * is split into 8 buckets, so a percentile is within 12.5% of the true
+ * value.  Every thread records into its own histograms without locks or
+ * atomic read-modify-writes, so recording a request costs a few
+ * nanoseconds.  stats_format() adds up every thread's histograms when
+ * the stats are asked for.
+ */
+
+
+/* This function returns the time on the monotonic clock.
+ * Parameters: None
+ * Returns: The time in nanoseconds
+ */
+extern long long stats_now();
+
+
+/* This function records a completed request in the calling thread's
+ *    histograms.
+ * Parameters:
+ *             level    : the scheduler level it completed at
+ *             size     : the bytes of its response body
+ *             arrived  : stats_now() when it arrived
+ *             admitted : stats_now() when it was admitted
+ *             started  : stats_now() when its first slice was sent
+ *             done     : stats_now() when it completed
+ * Returns: None
+ */
+extern void stats_record( int level, long long size, long long arrived,
+                          long long admitted, long long started,
+                          long long done );
+
+
+/* This function merges every thread's histograms and prints a summary of
+ *    each one that is not empty: count, mean, p50, p90, p99, p99.9 and max,
+ *    in microseconds.
+ * Parameters:
+ *             buf  : where to print
+ *             size : the size of buf
+ *             json : 0 for a text table, 1 for a JSON array
+ * Returns: The length of the summary, cut short to fit in buf
+ */
+extern int stats_format( char *buf, int size, int json );
+
+#endif
@@ -7,408 +7,1714 @@
  *          processes each client request.
  */
 
+#define _GNU_SOURCE                        /* for splice() and pipe2() */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <pthread.h> 
+#include <sched.h>
 #include <semaphore.h> 
 #include <time.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <signal.h>
+#include <poll.h>
+#include <limits.h>
 
 #include "network.h"
+#include "event.h"
+#include "fcache.h"
+#include "ccache.h"
+#include "http.h"
+#include "stats.h"
+#include "alog.h"
 #include "datastruct.h"
 
 #define MAX_HTTP_SIZE 8192                 /* size of buffer to allocate */
-#define MLFB_FIRST 8192
-#define MLFB_SECOND 65536
+#define MAX_EVENTS 256                     /* events handled per wakeup */
+#define MLFB_LEVELS 3                      /* default MLFB levels */
+#define MLFB_MAX_LEVELS 8                  /* -L: most MLFB levels */
+#define MLFB_QUANTUM 8192                  /* default level 0 quantum */
+#define MLFB_GROWTH 8                      /* quantum ratio of adjacent levels */
+#define MLFB_AGE 100                       /* default ms before promotion */
 #define RR_QUANTUM 8192
+#define DRR_QUANTUM 65536                  /* default bytes per DRR turn */
+#define SRPT_SLICE 65536                   /* default bytes per SRPT slice */
+#define MAX_WEIGHTS 16                     /* -w path weights */
+#define INJECT_SIZE 65536                  /* admitted clients not yet picked up */
+#define MAX_IDLE 1024                      /* kept-alive connections between requests */
+#define MAX_CPUS CPU_SETSIZE               /* -C: most CPUs listed */
+#define DRAIN_POLL 100                     /* ms between checks while draining */
+#define DRAIN_TIMEOUT 0                    /* default ms to finish clients, 0: no limit */
+#define LISTENER_ENV "SWS_LISTENER"        /* listener handed to -P workers */
+#define SLOT_ENV "SWS_SLOT"                /* which of the -P workers this is */
+#define READY_ENV "SWS_READY"              /* pipe a reloaded worker reports on */
+#define READY_TIMEOUT 10000                /* ms a reloaded worker has to start */
+
+#define STATS_PATH "__stats"               /* reserved path of the stats page */
+#define STATS_BODY 262144                  /* largest stats page */
+
+#define SERVE_DONE 0                       /* response finished */
+#define SERVE_MORE 1                       /* quantum sent, more to come */
+#define SERVE_BLOCKED 2                    /* socket full, park the client */
+#define SERVE_FAILED 3                     /* send error, client closed */
+
+struct worker;
+struct sleepers;
 
-/* struct to hold cli arguments passed to threads */
+/* struct to hold cli arguments passed to threads.  Normally one copy is
+ * shared by the acceptor and every worker; in sharded mode (-R) each worker
+ * gets its own copy with a private queue and listening socket.
+ */
 struct args {
-	struct linkedlist* list;
+	struct injectq* inject;			/* newly admitted clients */
+	struct heap* heap;			/* SJF and SRPT only */
+	struct fifo* levels;			/* MLFB only, mlfb_levels of them */
+	pthread_mutex_t* lock;			/* protects heap */
+	struct worker* workers;			/* workers that steal from each other */
+	int nworkers;
+	struct sleepers* sleepers;		/* idle workers, NULL if sharded */
+	struct event_loop* loop;
+	int listener;
 	int port;
+	int backlog;
+	int sharded;
+	int cpu;				/* -C: CPU of a shard's worker, or -1 */
+	int accepting;				/* listener still in the event loop */
+	pthread_mutex_t wait_lock;		/* protects waiting and closing */
+	struct client* waiting;			/* clients the loop watches for a request */
+	int closing;				/* draining: kept-alive clients are closed */
+};
+
+/* run queue owned by one scheduler thread (RR and DRR).  A client the
+ * worker requeues stays on its own deque; other workers only steal from it
+ * when idle.
+ */
+struct worker {
+	struct args* args;
+	struct deque queue;
+	unsigned int seed;			/* for picking steal victims */
+	sem_t wake;				/* posted to end an idle wait */
+	int sleeping;				/* on the sleepers stack */
+};
+
+/* workers with nothing to run, each blocked on its own semaphore.  Every
+ * job handed to the workers wakes exactly one of them, the one that went
+ * idle last (its cache is warmest); the others stay asleep.
+ */
+struct sleepers {
+	pthread_mutex_t lock;
+	struct worker** stack;			/* most recently idle on top */
+	int size;
+	atomic_int count;			/* size, readable without the lock */
 };
 
 pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t client_lock = PTHREAD_MUTEX_INITIALIZER;
+static char file_events;                   /* marks the file cache's descriptor */
+static char signal_events;                 /* marks signal_fd */
+static int signal_fd = -1;                 /* SIGUSR1: print stats, SIGTERM: drain */
+static char drain_events;                  /* marks drain_fd */
+static int drain_fd = -1;                  /* readable once draining, wakes every loop */
+static int max_idle = MAX_IDLE;            /* -k: cap on idle connections */
+static atomic_int idle_clients;            /* connections waiting to be reused */
+static atomic_int live_clients;            /* connections open */
+static atomic_int draining;                /* SIGTERM: finish clients, exit */
+static atomic_int drained;                 /* draining is over: threads return */
+static int drain_timeout = DRAIN_TIMEOUT;  /* -T: ms before draining gives up, 0 never */
+static int inherited = -1;                 /* listener from the supervisor */
+static char boundary[32];                  /* separates multipart/byteranges */
+static int drr_quantum = DRR_QUANTUM;      /* -q: bytes per DRR turn */
+static int srpt_slice = SRPT_SLICE;        /* -s: bytes per SRPT slice */
+static int mlfb_levels = MLFB_LEVELS;      /* -L: number of MLFB levels */
+static int mlfb_quantum[MLFB_MAX_LEVELS];  /* bytes per turn at each level */
+static int mlfb_age = MLFB_AGE;            /* -a: ms waited before promotion */
+static int cpus[MAX_CPUS];                 /* -C: CPUs to run on, in order */
+static int ncpus;                          /* 0: the kernel places threads */
+
+/* -w PREFIX=WEIGHT: DRR gives requests for paths starting with PREFIX
+ * WEIGHT quanta per turn */
+static struct {
+	char prefix[128];
+	int len;
+	int weight;
+} weights[MAX_WEIGHTS];
+static int nweights;
+
+
+/* does the request ask for the connection to be kept open?  HTTP/1.1 keeps
+ * it unless told to close, HTTP/1.0 only when asked, HTTP/0.9 never.
+ * Returns 0 to close, 1 to keep it open, 2 to keep it open and say so.
+ */
+static int wants_keepalive( const struct http_request *req ) {
+	const struct http_view *conn = http_header(req, "Connection");
+
+	if (req->minor < 0 || (conn && http_token(conn, "close"))) {
+		return 0;
+	} else if (conn && http_token(conn, "keep-alive")) {
+		return 2;
+	}
+	return req->minor >= 1;
+}
+
+/* the Connection header matching client->keepalive */
+static const char *connection_header( struct client* client ) {
+	static const char *headers[] = { "Connection: close\r\n", "", "Connection: keep-alive\r\n" };
+
+	return headers[client->keepalive];
+}
+
+/* assemble the response header in client->header from precomputed parts:
+ * the status line, the Date line of this second, the given fields (such as
+ * the file's cached Content-Length and Content-Type) and the Connection
+ * header.  Returns the length of the header.
+ */
+static int build_header( struct client* client, const char *status,
+                         const char *fields, int flen ) {
+	const char *conn = connection_header( client );
+	const char *date;
+	char *p = client->header;
+	int len;
+
+	date = http_date( &len );
+	p = mempcpy( p, status, strlen( status ) );
+	p = mempcpy( p, date, len );
+	p = mempcpy( p, fields, flen );
+	p = mempcpy( p, conn, strlen( conn ) );
+	p = mempcpy( p, "\r\n", 2 );
+	return p - client->header;
+}
+
+/* queue a response that has no body (an error, or an empty file).  It is
+ * scheduled and sent like any other header, so a client that is not
+ * reading gets it once its socket drains, in order with the responses
+ * before and after it.
+ */
+static void short_response( struct client* client, const char *status ) {
+	static const char fields[] = "Content-Length: 0\r\n";
+
+	client->hdrlen = build_header( client, status, fields, sizeof( fields ) - 1 );
+	client->hdr = client->header;
+	client->rem = 0;
+	client->partrem = 0;
+	client->nranges = 0;
+}
 
+/* print the content cache counters and the latency histograms into buf,
+ * as text or JSON.  Returns the length printed. */
+static int format_stats( char *buf, int size, int json ) {
+	struct ccache_stats stats;
+	int len;
 
-/* This function takes a file handle to a client, reads in the request, 
- *    parses the request, and sends back the requested file.  If the
- *    request is improper or the file is not available, the appropriate
- *    error is sent back.
+	ccache_stats(&stats);
+	if (json) {
+		len = snprintf(buf, size, "{\"ccache\":{\"hits\":%lu,\"misses\":%lu,\"evictions\":%lu,"
+				"\"rejected\":%lu,\"bytes\":%lu,\"files\":%lu},\n\"log_dropped\":%lu,\n\"latency\":",
+				stats.hits, stats.misses, stats.evictions, stats.rejections,
+				stats.bytes, stats.objects, alog_dropped());
+	} else {
+		len = snprintf(buf, size, "content cache: %lu hits %lu misses %lu evictions %lu rejected, %lu bytes in %lu files\n"
+				"access log: %lu records dropped\n",
+				stats.hits, stats.misses, stats.evictions, stats.rejections,
+				stats.bytes, stats.objects, alog_dropped());
+	}
+	len += stats_format(buf + len, size - len - 3, json);
+	len += sprintf(buf + len, json ? "}\n" : "");
+	return len;
+}
+
+/* set up the response for a request for STATS_PATH: the page is printed
+ * into a buffer the client owns, and sent from memory like a cached file.
+ * Returns 0 on success, -1 if out of memory. */
+static int stats_response( struct client* client, int json ) {
+	char fields[128];
+	int flen;
+	int len;
+
+	if (!(client->page = malloc(STATS_BODY))) {
+		return -1;
+	}
+	len = format_stats(client->page, STATS_BODY, json);
+	flen = sprintf(fields, "Content-Length: %d\r\nContent-Type: %s\r\nCache-Control: no-store\r\n",
+			len, json ? "application/json" : "text/plain; charset=utf-8");
+	client->hdrlen = build_header(client, "HTTP/1.1 200 OK\r\n", fields, flen);
+	client->hdr = client->header;
+	client->pos = 0;
+	client->rem = len;
+	client->partrem = len;
+	client->nranges = 0;
+	return 0;
+}
+
+/* format the header of part i of a multipart/byteranges response into out,
+ * or the closing boundary if i is past the last part.  Returns its length.
+ */
+static int part_header( struct client* client, int i, char *out ) {
+	long long size = client->file->size;
+	struct http_range *r = &client->ranges[i];
+
+	if (i == client->nranges) {
+		return sprintf(out, "\r\n--%s--\r\n", boundary);
+	}
+	return sprintf(out, "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %lld-%lld/%lld\r\n\r\n",
+			boundary, http_mime(client->filename), r->start, r->start + r->len - 1, size);
+}
+
+/* queue the header of the next part of a multipart response, and move the
+ * transfer to the part's first byte */
+static void next_part( struct client* client ) {
+	int i = client->range++;
+
+	client->hdrlen = part_header(client, i, client->header);
+	client->hdr = client->header;
+	if (i < client->nranges) {
+		client->pos = client->ranges[i].start;
+		client->partrem = client->ranges[i].len;
+	}
+}
+
+/* set up the response for an open, non-empty file: the whole file, or the
+ * ranges of it listed in the request's Range header.  The job size seen by
+ * the scheduler (client->rem) is the number of file bytes to send.
+ * Returns 1 if there is data to schedule, 0 if only a 416 header was queued.
+ */
+static int start_response( struct client* client, const struct http_request *req ) {
+	const struct http_view *range = http_header(req, "Range");
+	long long size = client->file->size;
+	long long total = 0;
+	char fields[256];
+	int flen;
+	int n = -1;
+	int i;
+
+	if (range) {
+		n = http_ranges(range, size, client->ranges, CLIENT_RANGES);
+	}
+	client->nranges = 0;
+	client->range = 0;
+	client->pos = 0;
+	client->rem = size;
+
+	if (n == 0) {                                     /* nothing satisfiable */
+		flen = sprintf(fields, "Content-Range: bytes */%lld\r\nContent-Length: 0\r\n", size);
+		client->hdrlen = build_header(client, "HTTP/1.1 416 Range not satisfiable\r\n", fields, flen);
+		client->hdr = client->header;
+		client->rem = 0;
+		client->partrem = 0;
+		return 0;
+	} else if (n == 1) {                              /* one range, 206 */
+		client->pos = client->ranges[0].start;
+		client->rem = client->ranges[0].len;
+		flen = sprintf(fields, "Content-Range: bytes %lld-%lld/%lld\r\nContent-Length: %lld\r\nContent-Type: %s\r\n",
+				client->ranges[0].start, client->ranges[0].start + client->ranges[0].len - 1, size,
+				client->ranges[0].len, http_mime(client->filename));
+		client->hdrlen = build_header(client, "HTTP/1.1 206 Partial Content\r\n", fields, flen);
+	} else if (n > 1) {                               /* multipart/byteranges */
+		client->nranges = n;
+		client->rem = 0;
+		for (i = 0; i <= n; i++) {                    /* parts and closing line */
+			total += part_header(client, i, fields);
+			if (i < n) {
+				total += client->ranges[i].len;
+				client->rem += client->ranges[i].len;
+			}
+		}
+		flen = sprintf(fields, "Content-Length: %lld\r\nContent-Type: multipart/byteranges; boundary=%s\r\n",
+				total, boundary);
+		client->hdrlen = build_header(client, "HTTP/1.1 206 Partial Content\r\n", fields, flen);
+		client->hdrlen += part_header(client, 0, client->header + client->hdrlen);
+		client->pos = client->ranges[0].start;
+		client->range = 1;
+	} else {                                          /* whole file */
+		client->hdrlen = build_header(client, "HTTP/1.1 200 OK\r\n",
+				client->file->header, client->file->hdrlen);
+	}
+	client->partrem = n > 1 ? client->ranges[0].len : client->rem;
+	client->hdr = client->header;                     /* goes out with the body */
+	return 1;
+}
+
+/* DRR weight of a request path: that of the first matching -w prefix, 1 if
+ * none matches */
+static int path_weight( const char *path ) {
+	for (int i=0; i<nweights; i++) {
+		if (!strncmp(path, weights[i].prefix, weights[i].len)) {
+			return weights[i].weight;
+		}
+	}
+	return 1;
+}
+
+/* This function reads the next request from a client connection into the
+ *    client's receive buffer and parses it.  Every request gets a response
+ *    to schedule: the file, or just a header if the request is improper,
+ *    the file is not available or it is empty.  Bytes after the request
+ *    stay buffered, so pipelined requests are served in order, one
+ *    response at a time.
  * Parameters: 
- *             fd : the file descriptor to the client connection
- * Returns: None
- */
-static void check_client( struct client* client ) {
-	static char *buffer;                              /* request buffer */
-	char *req = NULL;                                 /* ptr to req file */
-	char *brk;                                        /* state used by strtok */
-	char *tmp;                                        /* error checking ptr */
+ *             client : the client connection, with client->fd set
+ * Returns: 1 if a request was admitted and its response should be sent,
+ *          0 if the connection is finished and should be closed,
+ *          -1 if the next request has not arrived yet
+ */
+static int check_client( struct client* client ) {
+	struct http_request req;                          /* views into inbuf */
+	int end;                                          /* length of request */
 	int len;                                          /* length of data read */
+	int json;                                         /* stats page format */
+
+	for( ;; ) {
+		end = http_parse( client->inbuf + client->inoff, client->inlen - client->inoff,
+		                  &client->inscan, &req );
+		if( end == HTTP_INCOMPLETE && client->inoff > 0 ) {  /* make room */
+			client->inlen -= client->inoff;
+			memmove( client->inbuf, client->inbuf + client->inoff, client->inlen );
+			client->inoff = 0;
+		}
+		if( end == HTTP_INCOMPLETE && client->inlen == CLIENT_INBUF ) {  /* too big */
+			end = HTTP_ERROR;
+		} else if( end == HTTP_INCOMPLETE ) {           /* read more of it */
+			len = read( client->fd, client->inbuf + client->inlen,
+			            CLIENT_INBUF - client->inlen );
+			if( ( len < 0 ) && ( errno == EAGAIN || errno == EWOULDBLOCK ) ) {
+				return -1;                              /* socket is non-blocking */
+			} else if( ( len == 0 ) && ( client->inlen == 0 ) ) {
+				return 0;                               /* client is done */
+			} else if( len <= 0 ) {
+				perror( "Error while reading request" );
+				return 0;
+			}
+			client->inlen += len;
+			continue;
+		}
+
+		if( end == HTTP_ERROR || req.method.len != 3 ||
+				memcmp( req.method.ptr, "GET", 3 ) ) {      /* is req valid? */
+			client->keepalive = 0;
+			client->filename[0] = '\0';
+			short_response( client, "HTTP/1.1 400 Bad request\r\n" );    /* if not, send err */
+			break;
+		}
+		client->keepalive = max_idle > 0 && !atomic_load( &draining ) ?
+				wants_keepalive( &req ) : 0;
+
+		/* copy out the path, skipping the leading / */
+		len = req.path.len - 1 < 127 ? req.path.len - 1 : 127;
+		memcpy(client->filename,req.path.ptr + 1,len);
+		client->filename[len] = '\0';
+
+		client->inoff += end;                           /* keep what follows */
+		client->inscan = 0;
+		if( client->inoff == client->inlen ) {
+			client->inoff = client->inlen = 0;
+		}
+
+		json = !strcmp( client->filename, STATS_PATH ".json" );
+		if( json || !strcmp( client->filename, STATS_PATH ) ) {  /* reserved */
+			if( stats_response( client, json ) ) {
+				short_response( client, "HTTP/1.1 503 Service Unavailable\r\n" );
+			}
+		} else if( !( client->file = fcache_open( client->filename ) ) ) {  /* open file */
+			short_response( client, "HTTP/1.1 404 File not found\r\n" ); /* if not, send err */
+			alog_write(ALOG_NOTFOUND, client->filename, 0, 0, 0);
+		} else if( client->file->size == 0 ) {          /* nothing to schedule */
+			short_response( client, "HTTP/1.1 200 OK\r\n" );
+			fcache_release( client->file );
+			client->file = NULL;
+		} else if( !start_response( client, &req ) ) {  /* 416 */
+			fcache_release( client->file );
+			client->file = NULL;
+		}
+		break;
+	}
+
+	client->size = client->rem;                       /* admit the response */
+	client->admitted = stats_now();
+	client->started = 0;
+	client->xfer = XFER_SENDFILE;
+	client->level = 0;
+	client->deficit = 0;
+	client->weight = path_weight( client->filename );
+	if( client->file ) {
+		alog_write(ALOG_ADMIT, client->filename, client->rem, 0, 0);
+	}
+	return 1;
+}
+
+/* move up to len bytes of file in to socket out through a pipe, starting at
+ * *off.  Each thread keeps one pipe for the lifetime of the program.  If
+ * the socket fills up, bytes left in the pipe are given back by moving
+ * *off back, so the next call resends them from the file.
+ * Returns the number of bytes sent, or -1 on error.
+ */
+static ssize_t splice_chunk( int out, int in, off_t *off, size_t len ) {
+  static __thread int pipefd[2] = { -1, -1 };       /* per-thread pipe */
+  ssize_t n;                                        /* bytes in the pipe */
+  ssize_t m;                                        /* bytes not yet sent */
+
+  if( ( pipefd[0] < 0 ) && pipe2( pipefd, O_CLOEXEC ) ) {
+    return -1;
+  }
+
+  n = splice( in, off, pipefd[1], NULL, len, SPLICE_F_MOVE | SPLICE_F_MORE );
+  for( m = n; m > 0; m -= len ) {                   /* drain pipe to socket */
+    len = splice( pipefd[0], NULL, out, NULL, m,
+                  SPLICE_F_MOVE | SPLICE_F_MORE | SPLICE_F_NONBLOCK );
+    if( (ssize_t)len <= 0 ) {                       /* pipe not empty, reset */
+      int err = errno;
+      close( pipefd[0] );
+      close( pipefd[1] );
+      pipefd[0] = pipefd[1] = -1;
+      *off -= m;                                    /* unsent bytes */
+      errno = err;
+      return n > m ? n - m : -1;
+    }
+  }
+  return n;
+}
+
+/* copy up to len bytes of file in to socket out through buffer, starting
+ * at *off.  Used only where the kernel cannot send the file directly.
+ * Returns the number of bytes sent, or -1 on error.
+ */
+static ssize_t copy_chunk( int out, int in, off_t *off, size_t len,
+                           char *buffer ) {
+  ssize_t n;                                        /* bytes read */
+  ssize_t m;                                        /* bytes written */
+
+  n = pread( in, buffer, len < MAX_HTTP_SIZE ? len : MAX_HTTP_SIZE, *off );
+  if( n <= 0 ) {                                    /* check for errors */
+    return n < 0 ? -1 : 0;
+  }
+  for( m = 0; m < n; ) {
+    len = write( out, buffer + m, n - m );
+    if( (ssize_t)len <= 0 ) {                       /* keep what went out */
+      break;
+    }
+    m += len;
+  }
+  *off += m;
+  return m > 0 ? m : -1;
+}
+
+/* send up to len bytes of the in-memory body (cached file or generated
+ * page), starting at *off, with any header still pending in the same
+ * writev().  Returns the number of body
+ * bytes sent (possibly 0 if only header bytes went out), or -1 on error.
+ */
+static ssize_t write_chunk( struct client* client, off_t *off, size_t len ) {
+  struct iovec iov[2];                              /* header, body */
+  ssize_t n;                                        /* bytes written */
+  int cnt = 0;
+
+  if( client->hdrlen > 0 ) {
+    iov[cnt].iov_base = (void *)client->hdr;
+    iov[cnt++].iov_len = client->hdrlen;
+  }
+  iov[cnt].iov_base = ( client->body ? client->body->data : client->page ) + *off;
+  iov[cnt++].iov_len = len;
+
+  n = writev( client->fd, iov, cnt );
+  if( ( n > 0 ) && ( client->hdrlen > 0 ) ) {       /* header went first */
+    int h = n < client->hdrlen ? n : client->hdrlen;
+    client->hdr += h;
+    client->hdrlen -= h;
+    n -= h;
+  }
+  if( n > 0 ) {
+    *off += n;
+  }
+  return n;
+}
+
+/* send the header of the response if it is still pending.  If body bytes
+ * follow, the socket is told so, and the header shares a packet with them.
+ * Returns 0 on success, -1 on error (errno EAGAIN if the socket is full).
+ */
+static int send_header( struct client* client ) {
+  ssize_t n;
+
+  while( client->hdrlen > 0 ) {
+    n = send( client->fd, client->hdr, client->hdrlen,
+              client->rem > 0 ? MSG_MORE : 0 );
+    if( ( n < 0 ) && ( errno == EINTR ) ) {
+      continue;
+    } else if( n < 1 ) {
+      return -1;
+    }
+    client->hdr += n;
+    client->hdrlen -= n;
+  }
+  return 0;
+}
+
+/* drop the references held for the response being sent */
+static void end_response( struct client* client ) {
+  if (client->file) {
+    fcache_release(client->file);
+  }
+  if (client->body) {
+    ccache_release(client->body);
+  }
+  free(client->page);
+  client->file = NULL;
+  client->body = NULL;
+  client->page = NULL;
+  client->rem = 0;
+}
+
+/* close the connection and drop the client's references */
+static void close_client( struct client* client ) {
+  close(client->fd);
+  atomic_fetch_sub(&live_clients, 1);
+  end_response(client);
+  client->fd = -1;
+}
+
+/* This function sends the next mss bytes (at most) of the client's file,
+ *    with the response header in front of the first bytes.  The first
+ *    slice looks the body up in the content cache, so a miss reads it into
+ *    memory on the worker sending it, never on the thread admitting
+ *    requests.  Bodies held in memory, including a generated stats page,
+ *    go out in a single writev() together with the header.  Other
+ *    files are sent straight from the page cache with sendfile(), or
+ *    splice() where sendfile() is not supported, starting at client->pos.
+ *    Only files that support neither are copied through a buffer.  All of
+ *    these read at an offset, so no seek position is shared between
+ *    clients of the same file.
+ *
+ *    The bytes sent may be one range of the file (client->pos is where it
+ *    starts) or several, in which case each range goes out after its part
+ *    header and the closing boundary follows the last one.
+ *
+ *    Client sockets are non-blocking.  When a socket is full the bytes
+ *    that did go out are recorded in client->pos and client->rem, and the
+ *    caller should park the client until the socket is writable again.
+ * Parameters:
+ *             client : the client, with pos and rem describing what is left
+ *             mss    : the most bytes to send (the scheduler's quantum)
+ * Returns: SERVE_MORE if the quantum was sent and data is left,
+ *          SERVE_BLOCKED if the socket filled up before the quantum was sent,
+ *          SERVE_DONE if the response is complete; the connection stays
+ *          open (client->fd >= 0) only if the client asked to keep it,
+ *          SERVE_FAILED if sending failed and the connection was closed
+ */
+static int serve_client( struct client* client, off_t mss ) {
+  static __thread char *buffer;                     /* per-thread copy buffer */
+  off_t off = client->pos;                          /* file offset */
+  int in = client->file ? client->file->fd : -1;    /* file to send, if any */
+  ssize_t len = 0;                                  /* length of data sent */
+  off_t n;                                          /* amount to send */
+  off_t chunk;                                      /* amount of this range */
+  int mem;                                          /* body is in memory */
 
-	if( !buffer ) {                                   /* 1st time, alloc buffer */
-		buffer = malloc( MAX_HTTP_SIZE );
-		if( !buffer ) {                                 /* error check */
-			perror( "Error while allocating memory" );
-			abort();
-		}
-	}
-
-	memset( buffer, 0, MAX_HTTP_SIZE );
-	if( read( client->fd, buffer, MAX_HTTP_SIZE ) <= 0 ) {    /* read req from client */
-		perror( "Error while reading request" );
-		abort();
-	} 
-
-	/* standard requests are of the form
-	 *   GET /foo/bar/qux.html HTTP/1.1
-	 * We want the second token (the file path).
-	 */
-	tmp = strtok_r( buffer, " ", &brk );              /* parse request */
-	if( tmp && !strcmp( "GET", tmp ) ) {
-		req = strtok_r( NULL, " ", &brk );
-	}
-
-	if( !req ) {                                      /* is req valid? */
-		len = sprintf( buffer, "HTTP/1.1 400 Bad request\n\n" );
-		write( client->fd, buffer, len );                       /* if not, send err */
-	} else {                                          /* if so, open file */
-		req++;                                          /* skip leading / */
-		client->fin = fopen( req, "r" );                        /* open file */
-		char *filename = (char*)malloc(sizeof(char)*128);
-		strncpy(filename,req,127);
-		if( !client->fin ) {                                    /* check if successful */
-			len = sprintf( buffer, "HTTP/1.1 404 File not found\n\n" );  
-			write( client->fd, buffer, len );                     /* if not, send err */
-			printf("404 first write: %s\n",buffer);
-		} else {                                        /* if so, send file */
-			/* if so, send file */
-			len = sprintf( buffer, "HTTP/1.1 200 OK\n\n" );/* send success code */
-			write( client->fd, buffer, len );
-
-			//check size of file and rewind fin
-			fseek(client->fin,0,SEEK_END);
-			len = ftell(client->fin);
-			rewind(client->fin);
-			client->rem = len;
-			strncpy(client->filename,filename,127);
-			printf("received request for file %s\n",client->filename);
-		}
-	}
-}
-
-static int serve_client( struct client* client, int mss ) {
-  static char *buffer;                              /* request buffer */
-  int len;                                          /* length of data read */
-  int n;                                            /* amount to send */
-
-  if( !buffer ) {                                   /* 1st time, alloc buffer */
-    buffer = malloc( MAX_HTTP_SIZE );
-    if( !buffer ) {                                 /* error check */
-      perror( "error allocating memory" );
-      abort();
+  if( !client->started ) {                          /* first byte goes now */
+    client->started = stats_now();
+    if( client->file ) {
+      client->body = ccache_get( client->file );    /* a miss reads it here */
     }
   }
+  mem = client->body || client->page;
 
   n = mss;                                     /* compute send amount */
-  if( !n ) {                                         /* if 0, we're done */
-    return 0;
-  } else if( client->rem && ( client->rem < n ) ) {        /* if there is limit */
+  if( client->rem < n ) {                           /* if there is limit */
     n = client->rem;                                    /* send upto the limit */
   }
-  client->rem = client->rem - n;
-  client->pos = client->pos + n;				/* remember send size */
-
-  do {                                              /* loop, read & send file */
-    len = n < MAX_HTTP_SIZE ? n : MAX_HTTP_SIZE;    /* how much to read */
-    len = fread( buffer, 1, len, client->fin );         /* read file chunk */
-    if( len < 1 ) {                                 /* check for errors */
-      perror( "error reading file" );
-      return 0;
-    } else if( len > 0 ) {                          /* if none, send chunk */
-      len = write( client->fd, buffer, len );
-      if( len < 1 ) {                               /* check for errors */
-        perror( "error writing to client" );
-        return 0;
+
+  if( !mem && send_header( client ) ) {             /* disk: header first */
+    len = -1;
+  }
+
+  while( ( len >= 0 ) && ( n > 0 ) ) {              /* loop, send file */
+    if( client->partrem == 0 ) {                    /* next range */
+      next_part( client );
+      off = client->pos;
+      if( !mem && send_header( client ) ) {
+        len = -1;
+        break;
+      }
+    }
+    chunk = n < client->partrem ? n : client->partrem;
+
+    if( mem ) {
+      len = write_chunk( client, &off, chunk );
+      if( len == 0 ) {                              /* only header went out */
+        continue;
+      }
+    } else if( client->xfer == XFER_SENDFILE ) {
+      len = sendfile( client->fd, in, &off, chunk );
+    } else if( client->xfer == XFER_SPLICE ) {
+      len = splice_chunk( client->fd, in, &off, chunk );
+    } else {
+      if( !buffer ) {                               /* 1st time, alloc buffer */
+        buffer = malloc( MAX_HTTP_SIZE );
+        if( !buffer ) {                             /* error check */
+          perror( "error allocating memory" );
+          abort();
+        }
       }
-      n -= len;
+      len = copy_chunk( client->fd, in, &off, chunk, buffer );
     }
-  } while( ( n > 0 ) && ( len == MAX_HTTP_SIZE ) );  /* the last chunk < 8192 */
-  
-  if (client->rem == 0) {
-	   printf("Request for file %s completed.\n",client->filename); 
-	  close(client->fd);
-	  fclose(client->fin);
+
+    if( ( len < 0 ) && ( errno == EINVAL || errno == ENOSYS ) &&
+        !mem && ( client->xfer != XFER_COPY ) ) {   /* fall back */
+      client->xfer++;
+      len = 0;
+      continue;
+    } else if( ( len < 0 ) && ( errno == EINTR ) ) {
+      len = 0;
+      continue;
+    } else if( len == 0 ) {                         /* file shrank */
+      len = -1;
+      errno = EIO;
+    }
+    if( len < 0 ) {
+      break;
+    }
+
+    n -= len;
+    client->rem = client->rem - len;
+    client->partrem -= len;
+    client->pos = off;                              /* remember send size */
+  }
+
+  if( ( len >= 0 ) && ( client->rem == 0 ) && ( client->nranges > 1 ) &&
+      ( client->range == client->nranges ) ) {      /* multipart: close it */
+    next_part( client );
+  }
+  if( ( len >= 0 ) && send_header( client ) ) {     /* flush the header */
+    len = -1;
   }
 
-  return 1;
+  if( ( len < 0 ) && ( errno == EAGAIN || errno == EWOULDBLOCK ) ) {
+    return SERVE_BLOCKED;                           /* resume when writable */
+  } else if( len < 0 ) {                            /* give up on client */
+    perror( "error sending file" );
+    close_client(client);
+    return SERVE_FAILED;
+  }
+
+  if (client->rem == 0 && client->hdrlen == 0) {
+	  if (client->keepalive) {
+		  end_response(client);
+	  } else {
+		  close_client(client);
+	  }
+	  return SERVE_DONE;
+  }
+
+  return SERVE_MORE;
+}
+
+/* the client's socket is full: watch it in the event loop that admitted
+ * the client, which hands it back to the workers once it is writable.  The
+ * worker must not touch the client after parking it.
+ */
+static void park_client( struct args *args, struct client* client ) {
+	client->parked = 1;
+	if (event_rearm(args->loop, client->fd, EVENT_WRITE | EVENT_ONESHOT, client) < 0) {
+		perror("Error watching client");
+		close_client(client);
+		freeClient(client);
+	}
+}
+
+/* close the connection, if still open, and recycle the client */
+static void discard_client( struct client* client ) {
+	if (client->fd >= 0) {
+		close(client->fd);
+		atomic_fetch_sub(&live_clients, 1);
+	}
+	freeClient(client);
+}
+
+/* a job was queued: wake one idle worker, if any.  Costs one atomic load
+ * when every worker is busy.
+ */
+static void wake_worker( struct args *args ) {
+	struct sleepers *sleepers = args->sleepers;
+	struct worker *worker = NULL;
+
+	atomic_thread_fence(memory_order_seq_cst);    /* job is visible first */
+	if (!sleepers || atomic_load(&sleepers->count) == 0) {
+		return;
+	}
+	pthread_mutex_lock(&sleepers->lock);
+	if (sleepers->size > 0) {
+		worker = sleepers->stack[--sleepers->size];
+		worker->sleeping = 0;
+		atomic_fetch_sub(&sleepers->count, 1);
+	}
+	pthread_mutex_unlock(&sleepers->lock);
+	if (worker) {
+		sem_post(&worker->wake);
+	}
+}
+
+/* the inject queue is full and only this thread empties it (a shard):
+ * waiting would never end, so turn the client away.  A response not
+ * started yet is answered with a 503 if the socket takes it at once.
+ */
+static void reject_client( struct client* client ) {
+	if (!client->started) {
+		end_response(client);
+		client->keepalive = 0;
+		short_response(client, "HTTP/1.1 503 Service Unavailable\r\n");
+		send(client->fd, client->hdr, client->hdrlen, MSG_DONTWAIT);
+	}
+	close_client(client);
+	freeClient(client);
+}
+
+/* hand a client whose request was admitted to the workers without taking a
+ * lock */
+static void admit_client( struct args *args, struct client* client ) {
+	while (!injectPush(args->inject, client)) {
+		if (args->sharded) {
+			reject_client(client);
+			return;
+		}
+		sched_yield();                        /* workers are behind */
+	}
+	wake_worker(args);
+}
+
+/* the client is about to be watched for (the rest of) a request: list it,
+ * so that draining can close it.  Once draining has closed the list, a
+ * kept-alive client is refused.  Returns 0 if listed, -1 if refused.
+ */
+static int wait_request( struct args *args, struct client* client ) {
+	pthread_mutex_lock(&args->wait_lock);
+	if (args->closing && client->idle) {
+		pthread_mutex_unlock(&args->wait_lock);
+		return -1;
+	}
+	client->wprev = NULL;
+	client->wnext = args->waiting;
+	if (client->wnext) {
+		client->wnext->wprev = client;
+	}
+	args->waiting = client;
+	pthread_mutex_unlock(&args->wait_lock);
+	return 0;
+}
+
+/* the client's watch fired, or could not be set: take it off the list */
+static void end_wait( struct args *args, struct client* client ) {
+	pthread_mutex_lock(&args->wait_lock);
+	if (client->wprev) {
+		client->wprev->wnext = client->wnext;
+	} else {
+		args->waiting = client->wnext;
+	}
+	if (client->wnext) {
+		client->wnext->wprev = client->wprev;
+	}
+	client->wnext = client->wprev = NULL;
+	pthread_mutex_unlock(&args->wait_lock);
+}
+
+/* the response is complete and the client kept the connection: admit its
+ * next request if it is already buffered (pipelined), or wait for it in the
+ * event loop.  Beyond max_idle waiting connections, new ones are closed.
+ */
+static void next_request( struct args *args, struct client* client ) {
+	int admit;
+
+	client->arrived = stats_now();               /* if already buffered */
+	admit = check_client(client);
+	if (admit < 0 && atomic_load(&draining)) {
+		admit = 0;                              /* no more requests */
+	}
+
+	if (admit > 0) {
+		admit_client(args, client);
+		return;
+	}
+	if (admit < 0 && atomic_fetch_add(&idle_clients, 1) < max_idle) {
+		client->idle = 1;
+		if (wait_request(args, client) == 0) {
+			if (event_rearm(args->loop, client->fd, EVENT_READ | EVENT_ONESHOT, client) == 0) {
+				return;
+			}
+			end_wait(args, client);
+			perror("Error watching client");
+		}
+		client->idle = 0;
+	}
+	if (admit < 0) {
+		atomic_fetch_sub(&idle_clients, 1);
+	}
+	discard_client(client);
+}
+
+/* drain signal_fd: SIGTERM starts draining, SIGUSR1 prints the content
+ * cache counters and latency histograms */
+static void handle_signals() {
+	struct signalfd_siginfo info;
+	char *buf;
+
+	while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+		if (info.ssi_signo == SIGTERM) {
+			printf("%d: draining\n", getpid());
+			atomic_store(&draining, 1);
+			eventfd_write(drain_fd, 1);             /* other shards look too */
+		} else if ((buf = malloc(STATS_BODY)) != NULL) {
+			format_stats(buf, STATS_BODY, 0);
+			fputs(buf, stdout);
+			free(buf);
+		}
+		fflush(stdout);
+	}
+}
+
+/* create the listening socket and the event loop watching it */
+static void open_listener( struct args *args ) {
+	if (inherited >= 0) {                         /* shared by all processes */
+		args->listener = inherited;
+	} else {
+		args->listener = network_listen(args->port, args->backlog, args->sharded);
+	}
+	args->accepting = 1;
+	pthread_mutex_init(&args->wait_lock, NULL);
+	args->waiting = NULL;
+	args->closing = 0;
+	if (args->cpu >= 0 && inherited < 0 && network_cpu(args->listener, args->cpu) < 0) {
+		perror("Error setting SO_INCOMING_CPU");    /* still works, unsteered */
+	}
+	args->loop = event_init(MAX_EVENTS);
+	event_add(args->loop, args->listener, EVENT_READ, NULL);    /* NULL marks the listener */
+	if (fcache_fd() >= 0) {
+		event_add(args->loop, fcache_fd(), EVENT_READ, &file_events);
+	}
+	if (signal_fd >= 0) {
+		event_add(args->loop, signal_fd, EVENT_READ, &signal_events);
+	}
+	if (drain_fd >= 0) {
+		event_add(args->loop, drain_fd, EVENT_READ, &drain_events);
+	}
+}
+
+/* a connection was accepted: wait for its request in the event loop */
+static void watch_client( struct args *args, int fd ) {
+	struct client *client = newClient();
+
+	atomic_fetch_add(&live_clients, 1);
+	client->fd = fd;
+	client->arrived = stats_now();
+	wait_request(args, client);
+	if (event_add(args->loop, fd, EVENT_READ | EVENT_ONESHOT, client) < 0) {
+		perror("Error watching client");
+		end_wait(args, client);
+		discard_client(client);
+	}
+}
+
+/* once draining: stop accepting, close every connection waiting with no
+ * request in progress, and end the drain when no connection is left, or
+ * after drain_timeout ms if that is not 0.  Ending it sets drained, which
+ * every thread checks between jobs: each returns, and main() exits once it
+ * has joined them all.  Connections still queued on a listener shared
+ * with other processes are accepted by those.  The closed connections are
+ * shut down rather than closed here, so their watches fire and the loop
+ * discards them as if the clients had hung up.  Returns the timeout to wait
+ * with, short while draining so that the check comes round again.
+ */
+static int drain_check( struct args *args, int timeout ) {
+	static _Atomic long long deadline;
+	long long now;
+	long long none = 0;
+	struct client *client;
+
+	if (!atomic_load(&draining)) {
+		return timeout;
+	}
+	now = stats_now();
+	if (drain_timeout > 0) {
+		atomic_compare_exchange_strong(&deadline, &none, now + drain_timeout * 1000000LL);
+	}
+	if (args->accepting) {
+		event_del(args->loop, args->listener);
+		args->accepting = 0;
+		pthread_mutex_lock(&args->wait_lock);
+		args->closing = 1;
+		for (client = args->waiting; client; client = client->wnext) {
+			if (client->inlen == 0) {             /* nothing of a request yet */
+				shutdown(client->fd, SHUT_RDWR);
+			}
+		}
+		pthread_mutex_unlock(&args->wait_lock);
+	}
+	if (atomic_load(&live_clients) == 0 ||
+			(drain_timeout > 0 && now >= atomic_load(&deadline))) {
+		if (!atomic_exchange(&drained, 1)) {
+			if (atomic_load(&live_clients) == 0) {
+				printf("%d: drained\n", getpid());
+			} else {
+				printf("%d: drain timed out, %d connections cut\n", getpid(),
+						atomic_load(&live_clients));
+			}
+			for (int i=0; !args->sharded && i<args->nworkers; i++) {
+				sem_post(&args->workers[i].wake);      /* idle workers return */
+			}
+		}
+		return 0;
+	}
+	return timeout < 0 || timeout > DRAIN_POLL ? DRAIN_POLL : timeout;
+}
+
+/* wait up to timeout ms (-1 forever) for connections and requests, and
+ * admit every client whose request is ready.  The listening socket and every
+ * client that has not sent its request yet are watched by one event loop,
+ * so a slow client never holds up accepting or parsing the others.
+ */
+static void accept_clients( struct args *args, int timeout ) {
+	struct event events[MAX_EVENTS];
+	struct client *client;
+	int fd;
+	int n;
+
+	timeout = drain_check(args, timeout);
+	n = event_wait(args->loop, events, timeout);    /* wait for clients */
+
+	for (int i=0; i<n; i++) {
+		if (events[i].data == NULL) {
+			/* edge triggered: drain every waiting connection */
+			for( fd = network_accept(args->listener); fd >= 0; fd = network_accept(args->listener) ) {
+				watch_client(args, fd);
+			}
+			continue;
+		}
+		if (events[i].data == &file_events) {         /* files changed */
+			fcache_process();
+			continue;
+		}
+		if (events[i].data == &signal_events) {       /* stats requested */
+			handle_signals();
+			continue;
+		}
+		if (events[i].data == &drain_events) {        /* drain_check() next */
+			continue;
+		}
+
+		/* request arrived; the one-shot watch is already disarmed and
+		 * closing the socket later removes it from the loop */
+		client = (struct client*) events[i].data;
+		if (client->parked) {                     /* parked client is writable */
+			client->parked = 0;
+			admit_client(args, client);
+			continue;
+		}
+		end_wait(args, client);
+		if (client->idle) {                       /* kept-alive client is back */
+			client->arrived = stats_now();
+			client->idle = 0;
+			atomic_fetch_sub(&idle_clients, 1);
+		}
+		int admit = check_client(client);  /* process each client's request */
+		if (admit < 0 && wait_request(args, client) == 0) {
+			if (event_rearm(args->loop, client->fd, EVENT_READ | EVENT_ONESHOT, client) == 0) {
+				continue;                             /* wait for the rest */
+			}
+			end_wait(args, client);
+		}
+		if (admit <= 0) {
+			discard_client(client);
+			continue;
+		}
+
+		admit_client(args, client);
+	}
+}
+
+/* in sharded mode each worker accepts and parses its own clients between
+ * jobs */
+static void poll_shard( struct args *args ) {
+	if (args->sharded) {
+		accept_clients(args, 0);
+	}
+}
+
+/* is there a job this worker could pick up? */
+static int has_work( struct worker *self ) {
+	struct args *args = self->args;
+
+	if (injectSize(args->inject) > 0 || (args->heap && heapSize(args->heap) > 0)) {
+		return 1;
+	}
+	for (int i=0; args->levels && i<mlfb_levels; i++) {
+		if (fifoSize(&args->levels[i]) > 0) {
+			return 1;
+		}
+	}
+	for (int i=0; i<args->nworkers; i++) {
+		if (dequeSize(&args->workers[i].queue) > 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* nothing to run: sharded workers sleep in their event loop, the others
+ * join the sleepers until a new job wakes them.  A worker looks for work
+ * once more after joining, so a job queued just before it joined is not
+ * missed.
+ */
+static void idle_wait( struct worker *self ) {
+	struct args *args = self->args;
+	struct sleepers *sleepers = args->sleepers;
+
+	if (args->sharded) {
+		accept_clients(args, -1);
+		return;
+	}
+
+	pthread_mutex_lock(&sleepers->lock);
+	sleepers->stack[sleepers->size++] = self;
+	self->sleeping = 1;
+	atomic_fetch_add(&sleepers->count, 1);
+	pthread_mutex_unlock(&sleepers->lock);
+
+	atomic_thread_fence(memory_order_seq_cst);    /* pairs with wake_worker() */
+	if (has_work(self)) {
+		pthread_mutex_lock(&sleepers->lock);
+		if (self->sleeping) {                     /* nobody woke us, leave */
+			for (int i=0; i<sleepers->size; i++) {
+				if (sleepers->stack[i] == self) {
+					sleepers->stack[i] = sleepers->stack[--sleepers->size];
+					break;
+				}
+			}
+			self->sleeping = 0;
+			atomic_fetch_sub(&sleepers->count, 1);
+			pthread_mutex_unlock(&sleepers->lock);
+			return;
+		}
+		pthread_mutex_unlock(&sleepers->lock);        /* a post is coming */
+	}
+	while (sem_wait(&self->wake) < 0 && errno == EINTR);
+}
+
+/* take the oldest client from the queue of some other worker, starting at
+ * a random victim so that idle thieves spread out */
+static struct client *steal_client( struct worker *self ) {
+	struct args *args = self->args;
+	struct client *client;
+	int start = rand_r(&self->seed) % args->nworkers;
+
+	for (int i=0; i<args->nworkers; i++) {
+		struct worker *victim = &args->workers[(start + i) % args->nworkers];
+		if (victim != self && (client = dequeSteal(&victim->queue)) != NULL) {
+			return client;
+		}
+	}
+	return NULL;
+}
+
+/* act on the outcome of serve_client(); see run_client() */
+static int end_slice( struct args *args, struct client *client, int state ) {
+	switch (state) {
+	case SERVE_BLOCKED:
+		park_client(args, client);
+		return 0;
+	case SERVE_MORE:
+		return 1;
+	case SERVE_FAILED:
+		alog_write(ALOG_FAILED, client->filename, client->size, 0, client->level);
+		freeClient(client);                     /* already closed */
+		return 0;
+	default:
+		if (client->size > 0) {                 /* a body, not just a header */
+			long long done = stats_now();
+			stats_record(client->level, client->size, client->arrived,
+					client->admitted, client->started, done);
+			alog_write(ALOG_DONE, client->filename, client->size,
+					(done - client->arrived) / 1000, client->level);
+		}
+		if (client->fd >= 0) {                  /* kept alive */
+			next_request(args, client);
+		} else {
+			freeClient(client);                 /* recycle */
+		}
+		return 0;
+	}
+}
+
+/* give the client a quantum of mss bytes.  A client whose socket filled up
+ * is parked until it is writable, and then re-enters the scheduler through
+ * the inject queue like a new client.  So does the next request on a
+ * kept-alive connection once the response is complete.
+ * Returns 1 if the caller should requeue the client, 0 otherwise.
+ */
+static int run_client( struct args *args, struct client *client, off_t mss ) {
+	return end_slice(args, client, serve_client(client, mss));
 }
 
 /* loop function to receive clients */
 void *get_clients( void* vargs) {
 	struct args *args = (struct args*) vargs;
-	
-	network_init( args->port );                             /* init network module */
 
-	int fd;
-	int flag = 1;
+	while (!atomic_load(&drained)) {                  /* main request loop */
+		accept_clients(args, -1);
+	}
+	return NULL;
+}
+
+/* loop function to process clients using SJF.  Order matters across all
+ * workers, so they share one heap; the acceptor never touches its lock.
+ */
+void *proc_sjf( void* vself ) {
+	//printf("Commencing SJF scheduling\n");
+	struct worker *self = (struct worker*) vself;
+	struct args *args = self->args;
+	struct heap *heap = args->heap;
 	struct client *client;
-	for( ;; ) {                                       /* main request loop */
-		network_wait();                                 /* wait for clients */
+	while (!atomic_load(&drained)) {                  /* main SJF loop */
+		poll_shard(args);
+		if (heapSize(heap) == 0 && injectSize(args->inject) == 0) {
+			idle_wait(self);
+			continue;
+		}
 
-		for( fd = network_open(); fd >= 0; fd = network_open() ) { /* get clients */
-			if (flag) {
-				client = (struct client*) malloc(sizeof(struct client));
-				initClient(client);
-				client->fd = fd;
-	 			//lock critical section
-	 			pthread_mutex_lock(&client_lock);
-				check_client(client);  /* process each client's request */
-	 			pthread_mutex_unlock(&client_lock);
-	 			//unlock critical section
-				flag = 0;
-			}
+		//lock critical section
+		pthread_mutex_lock(args->lock);
 
-			//lock critical section
-			pthread_mutex_lock(&lock);
-			insertFirst(args->list, client);
-			printf("Request for file %s admitted\n",client->filename);
-			flag = 1;
-			pthread_mutex_unlock(&lock);
-			//unlock critical section
+		while ((client = injectPop(args->inject)) != NULL) {
+			heapInsert(heap, client);                   /* admit new clients */
+		}
+		client = heapPop(heap);                         /* shortest job */
+
+		pthread_mutex_unlock(args->lock);
+		//unlock critical section
+
+		//send file to client
+		if (client) {
+			alog_write(ALOG_SLICE, client->filename, client->rem, 0, 0);
+			if (run_client(args, client, client->rem)) {
+				pthread_mutex_lock(args->lock);
+				heapInsert(heap, client);               /* not done, back in */
+				pthread_mutex_unlock(args->lock);
+			}
 		}
 	}
+	return NULL;
 }
 
-/* loop function to process clients using SJF */
-void *proc_sjf( void* list ) {
-	//printf("Commencing SJF scheduling\n");
-	int flag = 0;
-	srand(time(NULL));
-	for( ;; ) {                                       /* main SJF loop */
-		int r = rand() % 1000;
-		usleep(r);
-		while(length(list) > 0) {
+/* loop function to process clients using SRPT.  Like SJF the workers
+ * share one heap ordered by bytes remaining, but a client only gets a slice
+ * of srpt_slice bytes at a time.  It then goes back into the heap keyed by
+ * what it has left, so a small request that arrives during a large transfer
+ * goes next.  The client is put back under the same lock that picks the
+ * next one.
+ */
+void *proc_srpt( void* vself ) {
+	struct worker *self = (struct worker*) vself;
+	struct args *args = self->args;
+	struct heap *heap = args->heap;
+	struct client *client;
+	struct client *requeue = NULL;
+	int waiting;
+
+	while (!atomic_load(&drained)) {
+		poll_shard(args);
+		if (!requeue && heapSize(heap) == 0 && injectSize(args->inject) == 0) {
+			idle_wait(self);
+			continue;
+		}
 
-			//lock critical section
-			pthread_mutex_lock(&lock);
+		//lock critical section
+		pthread_mutex_lock(args->lock);
+
+		if (requeue) {
+			heapInsert(heap, requeue);                  /* re-keyed by rem */
+		}
+		while ((client = injectPop(args->inject)) != NULL) {
+			heapInsert(heap, client);                   /* admit new clients */
+		}
+		client = heapPop(heap);                         /* least remaining */
+		waiting = heapSize(heap);
 
-			sort((struct linkedlist*) list);				/* sort to find shortest job */
-			struct client *client = deleteFirst((struct linkedlist*) list);
-			flag = 1;
+		pthread_mutex_unlock(args->lock);
+		//unlock critical section
 
-			pthread_mutex_unlock(&lock);
-			//unlock critical section
+		if (requeue && waiting > 0) {
+			wake_worker(args);                      /* someone can help */
+		}
+		requeue = NULL;
 
-			//send file to client
-			if (flag) {
-				int size = client->rem;
-	 			//lock critical section
-	 			pthread_mutex_lock(&client_lock);
-				serve_client(client, client->rem);
-	 			pthread_mutex_unlock(&client_lock);
-	 			//unlock critical section
-				printf("Sent %d bytes of file %s\n",size, client->filename); 
-				flag = 0;
+		//send a slice of the file to client
+		if (client) {
+			alog_write(ALOG_SLICE, client->filename,
+					client->rem < srpt_slice ? client->rem : srpt_slice, 0, 0);
+			if (run_client(args, client, srpt_slice)) {
+				requeue = client;
 			}
 		}
 	}
+	return NULL;
+}
+
+/* next client of a worker's rotation (RR and DRR): new clients join the
+ * back of the worker's deque, the oldest local client goes first, and an
+ * idle worker steals from the others.  A shard takes every new client at
+ * once, since nobody else empties its inject queue.
+ */
+static struct client *next_in_rotation( struct worker *self ) {
+	struct deque *local = &self->queue;
+	struct client *client;
+
+	while ((client = injectPop(self->args->inject)) != NULL) {
+		dequePush(local, client);
+		if (!self->args->sharded) {
+			break;                              /* leave some for the others */
+		}
+	}
+	do {                                            /* oldest local client */
+		client = dequeSteal(local);
+	} while (!client && dequeSize(local) > 0);
+	if (!client) {
+		client = steal_client(self);
+	}
+	return client;
 }
 
-/* loop function to process clients using RR */
-void *proc_rr( void* list ) {
+/* loop function to process clients using RR.  Each worker rotates through
+ * its own deque; new clients join the back of the rotation.
+ */
+void *proc_rr( void* vself ) {
 	//printf("Commencing RR scheduling\n");
-	int flag = 0; 
- 	srand(time(NULL));
-	for ( ;; ) {
-		int r = rand() % 1000;
-		usleep(r);
-		while(length(list) > 0) {
-			//lock critical section
-			pthread_mutex_lock(&lock);
-			
-			struct client *client = deleteFirst((struct linkedlist*) list);
-			//read from file in quantum						
-			flag = 1;
-			pthread_mutex_unlock(&lock);
-			//unlock critical section
-
-			//send file to client
-			if (flag) {
-				
-				if(client->rem <= RR_QUANTUM && client->rem > 0 && client->fd >0){
-					
- 					printf("Sent %d bytes of file %s \n",client->rem, client->filename);
-					pthread_mutex_lock(&client_lock);	
-					serve_client(client, client->rem);
-					pthread_mutex_unlock(&client_lock);
-					
-				}
-				else{				
-									
-					if(client->rem > 0 && client->fd >0){	
-						//lock critical section
-					        pthread_mutex_lock(&client_lock);
-						serve_client(client, RR_QUANTUM);	
-						pthread_mutex_unlock(&client_lock);
-						
-						pthread_mutex_lock(&lock);
-						if(client->fd >0)
-							insertLast((struct linkedlist*) list,client);	
-						pthread_mutex_unlock(&lock);	
-						printf("Sent %d bytes of file %s \n",RR_QUANTUM, client->filename);	
-							
-						//unlock critical section		
-					}
-									
-					
+	struct worker *self = (struct worker*) vself;
+	struct args *args = self->args;
+	struct deque *local = &self->queue;
+	struct client *client;
+	off_t mss;
+	while (!atomic_load(&drained)) {
+		poll_shard(args);
+
+		if ((client = next_in_rotation(self)) == NULL) {
+			idle_wait(self);
+			continue;
+		}
+
+		//send file to client
+		if(client->fd >0){
+			mss = client->rem < RR_QUANTUM ? client->rem : RR_QUANTUM;
+			alog_write(ALOG_SLICE, client->filename, mss, 0, 0);
+			if (run_client(args, client, mss)) {
+				dequePush(local, client);           /* requeue stays local */
+				if (dequeSize(local) > 1) {
+					wake_worker(args);              /* someone can steal */
 				}
-				flag = 0;
 			}
-		}//while ends
+		}
+	}
+	return NULL;
+}
+
+
+/* loop function to process clients using DRR.  Clients rotate like RR,
+ * but each turn adds drr_quantum times the client's weight to its deficit
+ * counter, and the client may send up to its deficit.  A slice cut short
+ * keeps the rest of its deficit for the next turn, except when the client
+ * is parked: an inactive client starts again from zero, as in DRR.
+ */
+void *proc_drr( void* vself ) {
+	struct worker *self = (struct worker*) vself;
+	struct args *args = self->args;
+	struct deque *local = &self->queue;
+	struct client *client;
+	off_t mss;
+	off_t rem;
+	int state;
+
+	while (!atomic_load(&drained)) {
+		poll_shard(args);
+
+		if ((client = next_in_rotation(self)) == NULL) {
+			idle_wait(self);
+			continue;
+		}
+
+		client->deficit += (long) drr_quantum * client->weight;    /* its turn */
+		mss = client->deficit < client->rem ? client->deficit : client->rem;
+		alog_write(ALOG_SLICE, client->filename, mss, 0, 0);
+
+		rem = client->rem;
+		state = serve_client(client, mss);
+		client->deficit -= rem - client->rem;
+		if (state != SERVE_MORE) {
+			client->deficit = 0;                    /* done or inactive */
+		}
+		if (end_slice(args, client, state)) {
+			dequePush(local, client);               /* back of the rotation */
+			if (dequeSize(local) > 1) {
+				wake_worker(args);                  /* someone can steal */
+			}
+		}
 	}
+	return NULL;
 }
 
+/* milliseconds on the monotonic clock */
+static long long now_ms() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/* aging: move every client that has waited longer than mlfb_age ms at
+ * its level up one level */
+static void age_levels( struct fifo *levels, long long now ) {
+	struct client *client;
+
+	for (int level=1; level<mlfb_levels; level++) {
+		while ((client = fifoPopBefore(&levels[level], now - mlfb_age)) != NULL) {
+			client->level = level - 1;
+			fifoPush(&levels[level - 1], client, now);
+		}
+	}
+}
 
-void *proc_mlfb( void* list ) {
+/* loop function to process clients using MLFB.  The levels are FIFO queues
+ * shared by every worker, so a demoted client goes to whichever worker is
+ * free first.  New requests enter level 0; a client that uses its whole
+ * quantum drops a level, and each level's quantum is MLFB_GROWTH times the
+ * one above.  The last level is round robin.  A client waiting longer than
+ * mlfb_age ms is promoted a level, so long transfers are not starved by a
+ * stream of short ones.
+ */
+void *proc_mlfb( void* vself ) {
 	//printf("Commencing MLFB scheduling\n");
-	int flag = 0;
-	struct linkedlist *list2 = (struct linkedlist*) malloc(sizeof(struct linkedlist));	//List to hold clients for chunk 2
-	initList(list2);
-	struct linkedlist *list3 = (struct linkedlist*) malloc(sizeof(struct linkedlist));  //List to hold clients for chunk 3
-	initList(list3);
-	
-	for ( ;; ) {
-		
-		
-		while(length(list) > 0) {
-			//lock critical section
-			pthread_mutex_lock(&lock);
-			
-			struct client *client = deleteFirst((struct linkedlist*) list);
-			//read from file in quantum						
-			flag = 1;
-			pthread_mutex_unlock(&lock);
-			//unlock critical section
-
-			//send file to client
-			if (flag) {
-
-				if(client->rem <= MLFB_FIRST && client->rem > 0){
-					
- 					printf("Sent %d bytes of file %s \n",client->rem, client->filename);
-					pthread_mutex_lock(&client_lock);	
-					serve_client(client, client->rem);
-					pthread_mutex_unlock(&client_lock);
-					
+	struct worker *self = (struct worker*) vself;
+	struct args *args = self->args;
+	struct fifo *levels = args->levels;
+	struct client *client;
+	long long now;
+	long long aged = 0;
+	int level;
+
+	while (!atomic_load(&drained)) {
+		poll_shard(args);
+
+		now = now_ms();
+		while ((client = injectPop(args->inject)) != NULL) {
+			fifoPush(&levels[client->level], client, now);  /* parked clients keep theirs */
+		}
+		if (mlfb_age > 0 && now != aged) {        /* at most once per ms */
+			age_levels(levels, now);
+			aged = now;
+		}
+
+		client = NULL;
+		for (level = 0; !client && level < mlfb_levels; level++) {
+			client = fifoPop(&levels[level]);     /* highest level first */
+		}
+		if (!client) {
+			idle_wait(self);
+			continue;
+		}
+
+		//send file to client
+		level = client->level;
+		alog_write(ALOG_SLICE, client->filename,
+				client->rem < mlfb_quantum[level] ? client->rem : mlfb_quantum[level], 0, level);
+		if (run_client(args, client, mlfb_quantum[level])) {
+			if (level < mlfb_levels - 1) {
+				client->level = ++level;              /* demote */
+			}
+			fifoPush(&levels[level], client, now_ms());
+			if (fifoSize(&levels[level]) > 1) {
+				wake_worker(args);                  /* another worker can help */
+			}
+		}
+	}
+	return NULL;
+}
+
+/* parse a CPU list such as 0-3,8 into cpus[].  Only CPUs the process may
+ * run on are accepted.  Returns the number of CPUs, or -1 if the list is
+ * malformed.
+ */
+static int parse_cpus( const char *list ) {
+	cpu_set_t allowed;
+	char *end;
+	long first;
+	long last;
+
+	sched_getaffinity(0, sizeof(allowed), &allowed);
+	ncpus = 0;
+	do {
+		first = last = strtol(list, &end, 10);
+		if (end != list && *end == '-') {
+			list = end + 1;
+			last = strtol(list, &end, 10);
+		}
+		if (end == list || first < 0 || last < first || last >= CPU_SETSIZE) {
+			return -1;
+		}
+		for (long cpu = first; cpu <= last; cpu++) {
+			if (!CPU_ISSET(cpu, &allowed) || ncpus == MAX_CPUS) {
+				return -1;
+			}
+			cpus[ncpus++] = cpu;
+		}
+		list = end + 1;
+	} while (*end == ',');
+	return *end == '\0' ? ncpus : -1;
+}
+
+/* keep only the part of the -C list that belongs to worker process slot
+ * of procs: an equal share of the CPUs each, or one CPU per process if
+ * there are fewer CPUs than processes.
+ */
+static void share_cpus( int slot, int procs ) {
+	int first;
+	int n;
+
+	if (ncpus >= procs) {
+		first = slot * ncpus / procs;
+		n = (slot + 1) * ncpus / procs - first;
+	} else {
+		first = slot % ncpus;
+		n = 1;
+	}
+	memmove(cpus, cpus + first, sizeof(int) * n);
+	ncpus = n;
+}
+
+/* CPU of the idx-th pinned thread: worker i gets the i-th CPU of -C and the
+ * acceptor the one after the workers', wrapping around when the list is
+ * shorter.  Returns -1 if threads are not pinned.
+ */
+static int cpu_of( int idx ) {
+	return ncpus ? cpus[idx % ncpus] : -1;
+}
+
+/* attributes of a thread that runs on cpu only, or anywhere if cpu is -1.
+ * A pinned thread keeps its caches warm, and the pages it touches first
+ * (the slabs of its pools, and so the clients it allocates) come from its
+ * own NUMA node.
+ */
+static pthread_attr_t *pinned( pthread_attr_t *attr, int cpu ) {
+	cpu_set_t set;
+
+	pthread_attr_init(attr);
+	if (cpu >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+	}
+	return attr;
+}
+
+/* start a worker process for the supervisor: this program with the same
+ * arguments, the listener inherited under LISTENER_ENV and its slot, which
+ * picks its share of the -C CPUs, under SLOT_ENV.  Exec'ing
+ * rather than only forking lets a reload pick up a new binary.  If ready
+ * is not NULL, the worker also gets the write end of a pipe under
+ * READY_ENV, and *ready is set to the read end (-1 on failure): a byte
+ * arrives once the worker serves, end of file if it dies first.  Returns
+ * the worker's pid, or -1 if it could not be started.
+ */
+static pid_t spawn_worker( char **argv, int listener, int slot, sigset_t *signals,
+		int *ready ) {
+	char fd[16];
+	int report[2] = { -1, -1 };
+	pid_t pid;
+
+	if (ready && pipe2(report, O_CLOEXEC) < 0) {
+		perror("Error starting worker");
+		*ready = -1;
+		return -1;
+	}
+	pid = fork();
+	if (pid < 0) {
+		perror("Error starting worker");
+	} else if (pid == 0) {
+		prctl(PR_SET_PDEATHSIG, SIGTERM);          /* drain if orphaned */
+		fcntl(listener, F_SETFD, 0);               /* keep it across exec */
+		snprintf(fd, sizeof(fd), "%d", listener);
+		setenv(LISTENER_ENV, fd, 1);
+		snprintf(fd, sizeof(fd), "%d", slot);
+		setenv(SLOT_ENV, fd, 1);
+		if (ready) {
+			fcntl(report[1], F_SETFD, 0);
+			snprintf(fd, sizeof(fd), "%d", report[1]);
+			setenv(READY_ENV, fd, 1);
+		}
+		signal(SIGHUP, SIG_IGN);                   /* meant for the supervisor */
+		sigprocmask(SIG_UNBLOCK, signals, NULL);
+		execvp(argv[0], argv);
+		perror("Error starting worker");
+		_exit(1);
+	}
+	if (ready) {
+		close(report[1]);
+		if (pid < 0) {
+			close(report[0]);
+			report[0] = -1;
+		}
+		*ready = report[0];
+	}
+	return pid;
+}
+
+/* wait until each of the n workers whose ready pipes are in fds reports
+ * that it serves, for READY_TIMEOUT ms at most.  ok[i] is set to 1 for each
+ * that did.  Returns 0 if all did, -1 if one failed or the time ran out.
+ */
+static int await_ready( int *fds, int *ok, int n ) {
+	struct pollfd *pfds = (struct pollfd*) calloc(n, sizeof(struct pollfd));
+	long long deadline = stats_now() + READY_TIMEOUT * 1000000LL;
+	long long left;
+	int waiting = 0;
+	char byte;
+
+	for (int i=0; i<n; i++) {
+		ok[i] = 0;
+		pfds[i].fd = fds[i];
+		pfds[i].events = POLLIN;
+		waiting += fds[i] >= 0;
+		if (fds[i] < 0) {                          /* never started */
+			free(pfds);
+			return -1;
+		}
+	}
+	while (waiting > 0 && (left = deadline - stats_now()) > 0) {
+		if (poll(pfds, n, left / 1000000 + 1) < 0 && errno != EINTR) {
+			break;
+		}
+		for (int i=0; i<n; i++) {
+			if (pfds[i].fd < 0 || !pfds[i].revents) {
+				continue;
+			}
+			if (read(pfds[i].fd, &byte, 1) != 1) {     /* died first */
+				free(pfds);
+				return -1;
+			}
+			ok[i] = 1;
+			pfds[i].fd = -1;                        /* poll() skips it now */
+			waiting--;
+		}
+	}
+	free(pfds);
+	return waiting == 0 ? 0 : -1;
+}
+
+/* supervisor mode (-P): keep procs worker processes accepting on one
+ * listening socket.  SIGHUP starts a new generation of workers and, once
+ * every one of them reports that it serves, tells the old one to drain
+ * with SIGTERM: the old workers stop accepting, finish their queued and
+ * in-flight clients and exit.  If a new worker dies or does not report
+ * within READY_TIMEOUT ms, the new generation is stopped instead and the
+ * old one keeps serving.  Connections keep
+ * queueing on the shared listener meanwhile, so none is refused.  A worker
+ * that dies on its own is replaced, unless it failed to start.  SIGTERM
+ * and SIGINT drain every worker, and the supervisor exits after them.
+ */
+static void supervise( char **argv, int procs, int port, int backlog ) {
+	struct signalfd_siginfo info;
+	pid_t *current = (pid_t*) malloc(sizeof(pid_t) * procs);
+	pid_t *fresh = (pid_t*) malloc(sizeof(pid_t) * procs);
+	int *ready = (int*) malloc(sizeof(int) * procs);
+	int *ok = (int*) malloc(sizeof(int) * procs);
+	int listener = network_listen(port, backlog, 0);
+	int running = 0;                               /* old and current workers */
+	int stopping = 0;
+	sigset_t signals;
+	pid_t pid;
+	int status;
+	int fd;
+
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGHUP);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &signals, NULL);
+	fd = signalfd(-1, &signals, SFD_CLOEXEC);
+
+	for (int i=0; i<procs; i++) {
+		current[i] = spawn_worker(argv, listener, i, &signals, NULL);
+		running += current[i] > 0;
+	}
+	printf("supervisor %d: %d workers\n", getpid(), running);
+	fflush(stdout);
+
+	while (running > 0) {
+		if (read(fd, &info, sizeof(info)) != sizeof(info)) {
+			continue;
+		}
+		switch (info.ssi_signo) {
+		case SIGHUP:                                  /* roll the workers */
+			if (stopping) {
+				break;
+			}
+			for (int i=0; i<procs; i++) {             /* new ones first */
+				fresh[i] = spawn_worker(argv, listener, i, &signals, &ready[i]);
+				running += fresh[i] > 0;
+			}
+			if (await_ready(ready, ok, procs) == 0) {
+				for (int i=0; i<procs; i++) {
+					if (current[i] > 0) {
+						kill(current[i], SIGTERM);          /* drain */
+					}
+					current[i] = fresh[i];
 				}
-				else{				
-								
-					if(client->rem > 0){	
-						//lock critical section
-					        pthread_mutex_lock(&client_lock);
-						serve_client(client, MLFB_FIRST);	
-						pthread_mutex_unlock(&client_lock);
-						
-						pthread_mutex_lock(&lock);
-						insertLast((struct linkedlist*) list2,client);	
-						pthread_mutex_unlock(&lock);	
-						printf("Sent %d bytes of file %s \n",MLFB_FIRST, client->filename);	
-							
-						//unlock critical section		
+				printf("supervisor %d: reloaded\n", getpid());
+			} else {
+				for (int i=0; i<procs; i++) {         /* keep the old ones */
+					if (fresh[i] > 0) {               /* a ready one may have clients */
+						kill(fresh[i], ok[i] ? SIGTERM : SIGKILL);
 					}
-									
-					
 				}
-				flag = 0;
-			}
-				
-		}//while ends
-
-
-		//pthread_mutex_unlock(&lock);
-		while(length(list2) > 0) {
-			//lock critical section
-			pthread_mutex_lock(&lock);
-			
-			struct client *client = deleteFirst((struct linkedlist*) list2);
-			//read from file in quantum						
-			flag = 1;
-			pthread_mutex_unlock(&lock);
-			//unlock critical section
-
-			//send file to client
-			if (flag) {
-
-				if(client->rem <= MLFB_SECOND && client->rem > 0){
-					
- 					printf("Sent %d bytes of file %s \n",client->rem, client->filename);
-					pthread_mutex_lock(&client_lock);	
-					serve_client(client, client->rem);
-					pthread_mutex_unlock(&client_lock);
-					
+				printf("supervisor %d: new workers did not start, reload abandoned\n", getpid());
+			}
+			for (int i=0; i<procs; i++) {
+				if (ready[i] >= 0) {
+					close(ready[i]);
 				}
-				else{				
-									
-					if(client->rem > 0){	
-						//lock critical section
-					        pthread_mutex_lock(&client_lock);
-						serve_client(client, MLFB_SECOND);	
-						pthread_mutex_unlock(&client_lock);
-						
-						pthread_mutex_lock(&lock);
-						insertLast((struct linkedlist*) list3,client);	
-						pthread_mutex_unlock(&lock);	
-						printf("Sent %d bytes of file %s \n",MLFB_SECOND, client->filename);	
-							
-						//unlock critical section		
-					}
-									
-					
+			}
+			break;
+		case SIGTERM:
+		case SIGINT:
+			stopping = 1;
+			for (int i=0; i<procs; i++) {
+				if (current[i] > 0) {
+					kill(current[i], SIGTERM);
 				}
-				flag = 0;
-			}
-				
-		}//while ends
-
-
-
-		while(length(list3) > 0) {
-			//lock critical section
-			pthread_mutex_lock(&lock);
-			
-			struct client *client = deleteFirst((struct linkedlist*) list3);
-			//read from file in quantum						
-			flag = 1;
-			pthread_mutex_unlock(&lock);
-			//unlock critical section
-
-			//send file to client
-			if (flag) {
-				
-				if(client->rem > 0){	
-					//lock critical section
-					pthread_mutex_lock(&client_lock);
-					serve_client(client, client->rem);	
-					pthread_mutex_unlock(&client_lock);
-										
-					printf("Sent %d bytes of file %s \n",client->rem, client->filename);	
-						
-					//unlock critical section		
+			}
+			break;
+		default:                                      /* SIGCHLD */
+			while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+				running--;
+				for (int i=0; i<procs; i++) {
+					if (current[i] != pid) {
+						continue;                     /* drained, as asked */
+					}
+					current[i] = 0;
+					if (!stopping && !(WIFEXITED(status) && WEXITSTATUS(status))) {
+						printf("supervisor %d: worker %d died, restarting\n", getpid(), pid);
+						current[i] = spawn_worker(argv, listener, i, &signals, NULL);
+						running += current[i] > 0;
+					}
 				}
-									
-					
 			}
-			flag = 0;
-						
-		}//while ends
-
+		}
+		fflush(stdout);
 	}
-
+	exit(0);
 }
 
 /* This function is where the program starts running.
@@ -422,95 +1728,283 @@ void *proc_mlfb( void* list ) {
  * Returns: an integer status code, 0 for success, something else for error.
  */
 int main( int argc, char **argv ) {
-	char* scheduler;
-	int port;
-	int threads;
-	if (argc < 2) {
-		printf("usage: ./sws [PORT] [SCHEDULER] [THREADS]\n...\n");
+	char *scheduler_list[5] = { "SJF", "RR", "MLFB", "DRR", "SRPT" };
+	char* scheduler = "SJF";
+	int port = 38080;
+	int threads = 1;
+	int backlog = NETWORK_BACKLOG;
+	int sharded = 0;
+	int files = FCACHE_ENTRIES;
+	long budget = CCACHE_BUDGET;
+	long quantum = MLFB_QUANTUM;
+	int verbosity = ALOG_VERBOSITY;
+	int procs = 0;
+	char **all_args = argv;                         /* for -P workers */
+	char *env;
+	int opt;
+	char *sep;
+
+	while ((opt = getopt(argc, argv, "RC:P:T:b:f:c:k:q:w:L:m:a:s:v:")) != -1) {
+		switch (opt) {
+		case 'R':                                       /* one listener per worker */
+			sharded = 1;
+			break;
+		case 'C':                                       /* CPUs to pin to */
+			if (parse_cpus(optarg) < 0) {
+				printf("CPUs are given as a list like 0-3,8 of CPUs this process may use\n");
+				exit(1);
+			}
+			break;
+		case 'P':                                       /* worker processes */
+			procs = (int) strtol(optarg, (char**)NULL,10);
+			if (procs < 1) {
+				printf("worker processes must be positive\n");
+				exit(1);
+			}
+			break;
+		case 'T':                                       /* drain timeout */
+			drain_timeout = (int) strtol(optarg, (char**)NULL,10);
+			break;
+		case 'b':                                       /* listen() backlog */
+			backlog = (int) strtol(optarg, (char**)NULL,10);
+			break;
+		case 'f':                                       /* open file cache size */
+			files = (int) strtol(optarg, (char**)NULL,10);
+			break;
+		case 'c':                                       /* content cache bytes */
+			budget = strtol(optarg, (char**)NULL,10);
+			break;
+		case 'k':                                       /* idle connections kept */
+			max_idle = (int) strtol(optarg, (char**)NULL,10);
+			break;
+		case 'q':                                       /* DRR quantum */
+			drr_quantum = (int) strtol(optarg, (char**)NULL,10);
+			if (drr_quantum <= 0) {
+				printf("DRR quantum must be positive\n");
+				exit(1);
+			}
+			break;
+		case 'w':                                       /* DRR path weight */
+			sep = strrchr(optarg, '=');
+			if (!sep || nweights == MAX_WEIGHTS || sep - optarg >= 128 ||
+					(weights[nweights].weight = (int) strtol(sep + 1, (char**)NULL,10)) <= 0) {
+				printf("weights are given as -w PATH_PREFIX=WEIGHT (at most %d)\n", MAX_WEIGHTS);
+				exit(1);
+			}
+			if (*optarg == '/') {                       /* paths are kept without it */
+				optarg++;
+			}
+			weights[nweights].len = sep - optarg;
+			memcpy(weights[nweights].prefix, optarg, weights[nweights].len);
+			nweights++;
+			break;
+		case 'L':                                       /* MLFB levels */
+			mlfb_levels = (int) strtol(optarg, (char**)NULL,10);
+			if (mlfb_levels < 1 || mlfb_levels > MLFB_MAX_LEVELS) {
+				printf("MLFB levels must be between 1 and %d\n", MLFB_MAX_LEVELS);
+				exit(1);
+			}
+			break;
+		case 'm':                                       /* MLFB level 0 quantum */
+			quantum = strtol(optarg, (char**)NULL,10);
+			if (quantum <= 0) {
+				printf("MLFB quantum must be positive\n");
+				exit(1);
+			}
+			break;
+		case 'a':                                       /* MLFB aging, 0 is off */
+			mlfb_age = (int) strtol(optarg, (char**)NULL,10);
+			break;
+		case 'v':                                       /* access log verbosity */
+			verbosity = (int) strtol(optarg, (char**)NULL,10);
+			break;
+		case 's':                                       /* SRPT slice */
+			srpt_slice = (int) strtol(optarg, (char**)NULL,10);
+			if (srpt_slice <= 0) {
+				printf("SRPT slice must be positive\n");
+				exit(1);
+			}
+			break;
+		default:
+			printf("usage: ./sws [-R] [-C CPUS] [-P PROCS] [-T DRAIN_MS] [-b BACKLOG] [-f FILES] [-c BYTES] [-k IDLE] [-q QUANTUM] [-w PREFIX=WEIGHT] [-L LEVELS] [-m QUANTUM] [-a AGE_MS] [-s SLICE] [-v VERBOSITY] [PORT] [SCHEDULER] [THREADS]\n");
+			exit(1);
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 1) {
+		printf("usage: ./sws [-R] [-C CPUS] [-P PROCS] [-T DRAIN_MS] [-b BACKLOG] [-f FILES] [-c BYTES] [-k IDLE] [-q QUANTUM] [-w PREFIX=WEIGHT] [-L LEVELS] [-m QUANTUM] [-a AGE_MS] [-s SLICE] [-v VERBOSITY] [PORT] [SCHEDULER] [THREADS]\n...\n");
 		printf("will run with default values\n");
-		port = 38080;
-		scheduler = "SJF";
-		threads = 1;
 	}
-	else if (argc < 3) {
-		port = (int) strtol(argv[1], (char**)NULL,10);
-		scheduler = "SJF";
-		threads = 1;
+	if (argc >= 1) {
+		port = (int) strtol(argv[0], (char**)NULL,10);
 	}
-	else if (argc < 4) {
-		port = (int) strtol(argv[1], (char**)NULL,10);
-		char *scheduler_list[3];
-		scheduler_list[0] = "SJF";
-		scheduler_list[1] = "RR";
-		scheduler_list[2] = "MLFB";
-		for(int i=0;i<3;i++) {
-			if (strcmp(argv[2],scheduler_list[i]) == 0) {
-				scheduler = argv[2];
+	if (argc >= 2) {
+		scheduler = NULL;
+		for(int i=0;i<5;i++) {
+			if (strcmp(argv[1],scheduler_list[i]) == 0) {
+				scheduler = argv[1];
 			}
 		}
-		threads = 1;
 	}
-	else {
-		port = (int) strtol(argv[1], (char**)NULL,10);
-		char *scheduler_list[3];
-		scheduler_list[0] = "SJF";
-		scheduler_list[1] = "RR";
-		scheduler_list[2] = "MLFB";
-		for(int i=0;i<3;i++) {
-			if (strcmp(argv[2],scheduler_list[i]) == 0) {
-				scheduler = argv[2];
-			}
-		}
-		scheduler = argv[2];
-		threads = (int) strtol(argv[3], (char**)NULL,10);
+	if (argc >= 3) {
+		threads = (int) strtol(argv[2], (char**)NULL,10);
 	}
 
-
 	if (scheduler == NULL) {
-		printf("Unrecognized scheduling algorithm\n Choices are : SJF RR MLFB\n");
+		printf("Unrecognized scheduling algorithm\n Choices are : SJF RR MLFB DRR SRPT\n");
 		exit(1);
 	} else {
-		printf("port: %d scheduler: %s threads: %d\n",port,scheduler,threads);
+		printf("port: %d scheduler: %s threads: %d%s%s\n",port,scheduler,threads,
+				sharded ? " (sharded)" : "", ncpus ? " (pinned)" : "");
+
+	}
+
+	void *(*proc)(void*);
+	if (strcmp(scheduler, "SJF") == 0) {
+		proc = proc_sjf;
+	}
+	else if (strcmp(scheduler, "RR") == 0) {
+		proc = proc_rr;
+	}
+	else if (strcmp(scheduler, "DRR") == 0) {
+		proc = proc_drr;
+	}
+	else if (strcmp(scheduler, "SRPT") == 0) {
+		proc = proc_srpt;
+	}
+	else {
+		proc = proc_mlfb;
+	}
+
+	for (int i=0; i<mlfb_levels; i++) {                /* quanta grow per level */
+		mlfb_quantum[i] = quantum < INT_MAX ? quantum : INT_MAX;
+		if (quantum < INT_MAX) {
+			quantum *= MLFB_GROWTH;
+		}
+	}
 
+	if ((env = getenv(LISTENER_ENV)) != NULL) {     /* started by -P */
+		inherited = (int) strtol(env, (char**)NULL,10);
+		if (ncpus && (env = getenv(SLOT_ENV)) != NULL) {
+			share_cpus((int) strtol(env, (char**)NULL,10), procs);
+		}
+	} else if (procs > 0) {
+		supervise(all_args, procs, port, backlog);    /* does not return */
 	}
 
-	struct linkedlist *list = (struct linkedlist*) malloc(sizeof(struct linkedlist));
-	initList(list);
+	http_init(HTTP_SIMD_BEST);
+	snprintf(boundary, sizeof(boundary), "sws%lx%x", (long)time(NULL), getpid());
+	fcache_init(files);
+	ccache_init(budget);
+	signal(SIGPIPE, SIG_IGN);                 /* report closed clients as EPIPE */
+
+	/* threads inherit the blocked signals, so only signal_fd sees them */
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGUSR1);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+	signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+	drain_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	alog_init(verbosity);                     /* flusher thread inherits the mask */
 
-	struct args *args = (struct args*) malloc(sizeof(struct linkedlist));
+	struct args *args = (struct args*) malloc(sizeof(struct args));
 	args->port = port;                                    /* server port # */
-	args->list = list;
+	args->backlog = backlog;
+	args->heap = NULL;
+	args->levels = NULL;
+	args->sleepers = NULL;
+	args->lock = &lock;
+	args->sharded = sharded;
+	args->cpu = -1;
 
 	/* threads to receive requests and send file data */
 	pthread_t get_reqs;
-	pthread_t *send_files = (pthread_t*)malloc(sizeof(pthread_t) * threads); 
+	pthread_attr_t attr;
+	cpu_set_t here;
+	cpu_set_t anywhere;
 
-	/* create request parsing thread */
-	pthread_create(&get_reqs, NULL, get_clients, (void*) args);
+	sched_getaffinity(0, sizeof(anywhere), &anywhere);
+	pthread_t *send_files = (pthread_t*)malloc(sizeof(pthread_t) * threads); 
+	struct worker *workers = (struct worker*)malloc(sizeof(struct worker) * threads);
 
-	/* create SJF thread */
-	if (strcmp(scheduler, "SJF") == 0) {
-		for (int i=0; i<threads; i++) {
-			pthread_create(&send_files[i], NULL, proc_sjf, (void*) list);
+	for (int i=0; i<threads; i++) {
+		struct args *shared = args;
+		if (ncpus) {
+			/* set up worker i from its CPU, so that the memory first
+			 * touched here is on its node */
+			CPU_ZERO(&here);
+			CPU_SET(cpu_of(i), &here);
+			sched_setaffinity(0, sizeof(here), &here);
 		}
-	}
-	/* create RR thread */
-	else if (strcmp(scheduler, "RR") == 0) {
-		for (int i=0; i<threads; i++) {
-			pthread_create(&send_files[i], NULL, proc_rr, (void*) list);
+		if (sharded) {
+			/* every worker owns a listener and its own queues */
+			shared = (struct args*) malloc(sizeof(struct args));
+			*shared = *args;
+			shared->lock = (pthread_mutex_t*) malloc(sizeof(pthread_mutex_t));
+			pthread_mutex_init(shared->lock, NULL);
+			shared->workers = &workers[i];
+			shared->nworkers = 1;
+			shared->cpu = cpu_of(i);              /* steer its connections */
+		} else if (i == 0) {
+			args->workers = workers;
+			args->nworkers = threads;
+			args->sleepers = (struct sleepers*) malloc(sizeof(struct sleepers));
+			pthread_mutex_init(&args->sleepers->lock, NULL);
+			args->sleepers->stack = (struct worker**) malloc(sizeof(struct worker*) * threads);
+			args->sleepers->size = 0;
+			atomic_init(&args->sleepers->count, 0);
 		}
-	}
-	/* create MLFB thread */
-	else {
-		for (int i=0; i<threads; i++) {
-			pthread_create(&send_files[i], NULL, proc_mlfb, (void*) list);
+		if (sharded || i == 0) {
+			shared->inject = (struct injectq*) malloc(sizeof(struct injectq));
+			initInject(shared->inject, INJECT_SIZE);
+			if (proc == proc_sjf || proc == proc_srpt) {
+				shared->heap = (struct heap*) malloc(sizeof(struct heap));
+				initHeap(shared->heap);
+			}
+			if (proc == proc_mlfb) {
+				shared->levels = (struct fifo*) malloc(sizeof(struct fifo) * mlfb_levels);
+				for (int j=0; j<mlfb_levels; j++) {
+					initFifo(&shared->levels[j]);
+				}
+			}
+			open_listener(shared);
 		}
+
+		workers[i].args = shared;
+		workers[i].seed = i + 1;
+		workers[i].sleeping = 0;
+		sem_init(&workers[i].wake, 0, 0);
+		initDeque(&workers[i].queue);
+	}
+	if (ncpus) {
+		sched_setaffinity(0, sizeof(anywhere), &anywhere);    /* set up, move back */
+	}
+
+	if (!sharded) {
+		/* create request parsing thread */
+		pthread_create(&get_reqs, pinned(&attr, cpu_of(threads)), get_clients, (void*) args);
+	}
+
+	/* create scheduler threads */
+	for (int i=0; i<threads; i++) {
+		pthread_create(&send_files[i], pinned(&attr, cpu_of(i)), proc, (void*) &workers[i]);
+	}
+	if ((env = getenv(READY_ENV)) != NULL) {        /* reloaded: serving now */
+		int ready = (int) strtol(env, (char**)NULL,10);
+		write(ready, "", 1);
+		close(ready);
 	}
 
 	/* join threads*/
-	pthread_join(get_reqs, NULL);
+	if (!sharded) {
+		pthread_join(get_reqs, NULL);
+	}
 	for (int i=0; i<threads;i++) {
 		pthread_join(send_files[i], NULL);
 	}
+	alog_sync();                              /* drained: log it all, exit */
+	return 0;
 }
-